@@ -0,0 +1,152 @@
+/**
+    @file bitboard.h
+    @author Ian M Brain (imbrain)
+    Operations on the bitboard form of the puzzle board.
+    Each move is three bits in a row, so legality is a few ANDs of shifted copies of the peg and
+    hole sets, and performing (or undoing) a move flips the same three bits in both sets.
+    Also converts between the bitboard and the text form of the board used by reset and show.
+*/
+
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common.h"
+
+// Bit for the cell at row r, column c.
+#define CELL_BIT( r, c ) ( 1ULL << ( ( r ) * GRID_SIZE + ( c ) ) )
+
+// Cells in the first six columns, the only places a right move can start.
+#define LEFT_COLUMNS 0x3F3F3F3F3F3F3F3FULL
+
+// Cells in the last six columns, the only places a left move can start.
+#define RIGHT_COLUMNS 0xFCFCFCFCFCFCFCFCULL
+
+// Length of the text form of the board, eight rows of eight cells and a newline.
+#define BOARD_TEXT_SIZE ( GRID_SIZE * ( GRID_SIZE + 1 ) )
+
+// Bit offset of one step in each direction, indexed by the direction constants.
+static int const dirStep[ 4 ] = { 1, GRID_SIZE, -1, -GRID_SIZE };
+
+// Command name of each direction, indexed by the direction constants.
+static char const *const dirNames[ 4 ] = { "right", "down", "left", "up" };
+
+// Pack a move from ( r, c ) in direction dir into one byte, and get the parts back out.
+#define MOVE_CODE( r, c, dir ) ( ( unsigned char ) ( ( ( ( r ) * GRID_SIZE + ( c ) ) << 2 ) | ( dir ) ) )
+#define MOVE_ROW( code ) ( ( ( code ) >> 2 ) / GRID_SIZE )
+#define MOVE_COL( code ) ( ( ( code ) >> 2 ) % GRID_SIZE )
+#define MOVE_DIR( code ) ( ( code ) & 3 )
+
+// Shift a set of cells by the given (possibly negative) number of bits.
+static inline uint64_t shiftCells( uint64_t cells, int shift ) {
+  return shift >= 0 ? cells >> shift : cells << -shift;
+}
+
+// Cells from which a move in the given direction is legal. The peg, the peg it jumps over
+// and the hole it lands in are lined up by shifting the sets back by one and two steps.
+static inline uint64_t movableCells( Bitboard const *board, int dir ) {
+  int step = dirStep[ dir ];
+  uint64_t cells = board->pegs & shiftCells( board->pegs, step ) & shiftCells( board->holes, 2 * step );
+
+  // Horizontal moves must not wrap from one row to the next.
+  if ( dir == RIGHT_DIR )
+    cells &= LEFT_COLUMNS;
+  else if ( dir == LEFT_DIR )
+    cells &= RIGHT_COLUMNS;
+
+  return cells;
+}
+
+// The three cells a move from ( r, c ) in the given direction changes.
+static inline uint64_t moveCells( int r, int c, int dir ) {
+  int cell = r * GRID_SIZE + c;
+  int step = dirStep[ dir ];
+  return ( 1ULL << cell ) | ( 1ULL << ( cell + step ) ) | ( 1ULL << ( cell + 2 * step ) );
+}
+
+// Flip the cells of a move. Doing this twice undoes the move.
+static inline void toggleMove( Bitboard *board, int r, int c, int dir ) {
+  uint64_t cells = moveCells( r, c, dir );
+  board->pegs ^= cells;
+  board->holes ^= cells;
+}
+
+// Make the move from ( r, c ) in the given direction if it is legal.
+// Returns false, leaving the board as it was, if it is not.
+static inline bool bitboardMove( Bitboard *board, int r, int c, int dir ) {
+  if ( r < 0 || r >= GRID_SIZE || c < 0 || c >= GRID_SIZE || dir < RIGHT_DIR || dir > UP_DIR )
+    return false;
+
+  if ( !( movableCells( board, dir ) & CELL_BIT( r, c ) ) )
+    return false;
+
+  toggleMove( board, r, c, dir );
+  return true;
+}
+
+// Build a bitboard from the pegs and the cells that are part of the board.
+static inline Bitboard boardFromPegs( uint64_t valid, uint64_t pegs ) {
+  Bitboard board = { pegs, valid & ~pegs };
+  return board;
+}
+
+// Build a bitboard from the text form of a board, one row of 'o', '.' and '#' per line.
+static inline void boardFromText( char const text[ GRID_SIZE ][ GRID_SIZE + 1 ], Bitboard *board ) {
+  board->pegs = 0;
+  board->holes = 0;
+  for ( int r = 0; r < GRID_SIZE; r++ ) {
+    for ( int c = 0; c < GRID_SIZE; c++ ) {
+      if ( text[ r ][ c ] == 'o' )
+        board->pegs |= CELL_BIT( r, c );
+      else if ( text[ r ][ c ] == '.' )
+        board->holes |= CELL_BIT( r, c );
+    }
+  }
+}
+
+// Write the text form of a board into text, which must have room for BOARD_TEXT_SIZE + 1 characters.
+static inline void boardToText( Bitboard const *board, char *text ) {
+  for ( int r = 0; r < GRID_SIZE; r++ ) {
+    for ( int c = 0; c < GRID_SIZE; c++ ) {
+      uint64_t bit = CELL_BIT( r, c );
+      *text++ = ( board->pegs & bit ) ? 'o' : ( board->holes & bit ) ? '.' : '#';
+    }
+    *text++ = '\n';
+  }
+  *text = '\0';
+}
+
+/* Citing Help from other assignments
+* The code for reading and checking the board file is based on reset.c from this assignment.
+*/
+// Read a board file of eight lines of eight 'o', '.' or '#' characters.
+// Returns false if the file can't be read or isn't a valid board.
+static inline bool readBoardFile( char const *path, Bitboard *board ) {
+  int fd = open( path, O_RDONLY );
+  if ( fd == -1 )
+    return false;
+
+  // Read one more character than a board has, to make sure there isn't any extra.
+  char text[ GRID_SIZE ][ GRID_SIZE + 1 ];
+  char extra;
+  bool valid = read( fd, text, sizeof( text ) ) == sizeof( text ) && read( fd, &extra, 1 ) == 0;
+  close( fd );
+
+  // Every line must be eight board characters and a newline.
+  for ( int r = 0; valid && r < GRID_SIZE; r++ ) {
+    if ( text[ r ][ GRID_SIZE ] != '\n' )
+      valid = false;
+    for ( int c = 0; valid && c < GRID_SIZE; c++ )
+      if ( text[ r ][ c ] != 'o' && text[ r ][ c ] != '.' && text[ r ][ c ] != '#' )
+        valid = false;
+  }
+
+  if ( valid )
+    boardFromText( text, board );
+  return valid;
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+    @file build-endgame.c
+    @author Ian M Brain (imbrain)
+    This program builds the endgame database read by peg and the hw_two server (see endgame.h).
+    Enumerates every position reachable from a puzzle board one move at a time, keeping only the
+    canonical form of each, then works back from the last level to find which of them can still
+    be taken down to one peg. Those are written out as the database's hash table.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "bitboard.h"
+#include "symmetry.h"
+#include "endgame.h"
+
+// Slots in a new set, before it grows.
+#define INITIAL_SLOTS 1024
+
+// Print out an error message and exit.
+static void fail( char const *message ) {
+  fprintf( stderr, "%s\n", message );
+  exit( 1 );
+}
+
+// Print out a usage message and exit.
+static void usage() {
+  fprintf( stderr, "usage: build-endgame <puzzle-file> [database-file]\n" );
+  exit( 1 );
+}
+
+// Growable set of canonical peg sets, using the same table layout as the database.
+struct KeySet {
+  /** Slots of the table, zero where empty. */
+  uint64_t *table;
+
+  /** Number of slots, a power of two. */
+  uint64_t slots;
+
+  /** Number of keys stored. */
+  uint64_t count;
+} typedef KeySet;
+
+// All the positions with one number of pegs.
+struct Level {
+  /** Canonical peg sets of the positions. */
+  uint64_t *keys;
+
+  /** Number of positions. */
+  uint64_t count;
+} typedef Level;
+
+// Make an empty set with the given number of slots.
+static void initKeySet( KeySet *set, uint64_t slots ) {
+  set->table = ( uint64_t * ) calloc( slots, sizeof( uint64_t ) );
+  if ( !set->table )
+    fail( "Out of memory" );
+  set->slots = slots;
+  set->count = 0;
+}
+
+// Add a key to the set, doubling the table once it is half full.
+static void addKey( KeySet *set, uint64_t key ) {
+  if ( ( set->count + 1 ) * 2 > set->slots ) {
+    KeySet bigger;
+    initKeySet( &bigger, set->slots * 2 );
+    for ( uint64_t slot = 0; slot < set->slots; slot++ )
+      if ( set->table[ slot ] )
+        endgameInsert( bigger.table, bigger.slots, set->table[ slot ] );
+    bigger.count = set->count;
+    free( set->table );
+    *set = bigger;
+  }
+
+  if ( endgameInsert( set->table, set->slots, key ) )
+    set->count++;
+}
+
+// Move the keys of a set into a level, freeing the set.
+static void setToLevel( KeySet *set, Level *level ) {
+  level->keys = ( uint64_t * ) malloc( ( set->count ? set->count : 1 ) * sizeof( uint64_t ) );
+  if ( !level->keys )
+    fail( "Out of memory" );
+
+  level->count = 0;
+  for ( uint64_t slot = 0; slot < set->slots; slot++ )
+    if ( set->table[ slot ] )
+      level->keys[ level->count++ ] = set->table[ slot ];
+  free( set->table );
+}
+
+// Call visit with the canonical peg set of each position one move away from the given pegs.
+// Stops early and returns true as soon as visit does.
+static bool forEachChild( SymmetryTables const *symmetry, uint64_t valid, uint64_t pegs,
+                          bool ( *visit )( uint64_t, void * ), void *arg ) {
+  Bitboard board = { pegs, valid & ~pegs };
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+    for ( uint64_t cells = movableCells( &board, dir ); cells; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+      uint64_t child = pegs ^ moveCells( cell / GRID_SIZE, cell % GRID_SIZE, dir );
+      if ( visit( canonicalPegs( symmetry, child ), arg ) )
+        return true;
+    }
+  }
+  return false;
+}
+
+// Visitor that adds each child to a set.
+static bool addChild( uint64_t key, void *arg ) {
+  addKey( ( KeySet * ) arg, key );
+  return false;
+}
+
+// Visitor that stops at the first child in a set.
+static bool childInSet( uint64_t key, void *arg ) {
+  KeySet const *set = ( KeySet const * ) arg;
+  return endgameContains( set->table, set->slots, key );
+}
+
+int main( int argc, char *argv[] ) {
+  if ( argc < 2 || argc > 3 )
+    usage();
+  char const *output = argc == 3 ? argv[ 2 ] : ENDGAME_FILE;
+
+  // Read the board to start from.
+  Bitboard start;
+  if ( !readBoardFile( argv[ 1 ], &start ) ) {
+    char errorMessage[ 1024 + 20 ] = "";
+    snprintf( errorMessage, sizeof( errorMessage ), "Invalid input file: %s", argv[ 1 ] );
+    fail( errorMessage );
+  }
+
+  uint64_t valid = start.pegs | start.holes;
+  int pegCount = __builtin_popcountll( start.pegs );
+  if ( pegCount == 0 )
+    fail( "The board has no pegs" );
+
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+
+  static SymmetryTables symmetry;
+  initSymmetryTables( &symmetry, valid );
+
+  // Level i holds the positions i moves from the start, each one with one less peg.
+  Level levels[ CELLS ];
+  KeySet set;
+  initKeySet( &set, INITIAL_SLOTS );
+  addKey( &set, canonicalPegs( &symmetry, start.pegs ) );
+  setToLevel( &set, &levels[ 0 ] );
+
+  int levelCount = 1;
+  uint64_t reachable = 1;
+  while ( levels[ levelCount - 1 ].count > 0 ) {
+    Level const *prev = &levels[ levelCount - 1 ];
+    initKeySet( &set, INITIAL_SLOTS );
+    for ( uint64_t i = 0; i < prev->count; i++ )
+      forEachChild( &symmetry, valid, prev->keys[ i ], addChild, &set );
+    setToLevel( &set, &levels[ levelCount ] );
+    reachable += levels[ levelCount ].count;
+    levelCount++;
+  }
+
+  // Work back up from the deepest level. A position is solvable if it has one peg,
+  // or if it has a move to a solvable position on the next level.
+  KeySet solvable = { NULL, 0, 0 };
+  KeySet all;
+  initKeySet( &all, INITIAL_SLOTS );
+  for ( int level = levelCount - 1; level >= 0; level-- ) {
+    KeySet current;
+    initKeySet( &current, INITIAL_SLOTS );
+    for ( uint64_t i = 0; i < levels[ level ].count; i++ ) {
+      uint64_t key = levels[ level ].keys[ i ];
+      if ( __builtin_popcountll( key ) == 1 ||
+           ( solvable.table && forEachChild( &symmetry, valid, key, childInSet, &solvable ) ) ) {
+        addKey( &current, key );
+        addKey( &all, key );
+      }
+    }
+
+    free( levels[ level ].keys );
+    free( solvable.table );
+    solvable = current;
+  }
+  free( solvable.table );
+
+  // Write the header and table of solvable positions.
+  EndgameHeader header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, ENDGAME_MAGIC, sizeof( header.magic ) );
+  header.valid = valid;
+  header.start = start.pegs;
+  header.count = all.count;
+  header.slots = all.slots;
+
+  FILE *fp = fopen( output, "w" );
+  if ( !fp )
+    fail( "Can't open the database file" );
+  bool written = fwrite( &header, sizeof( header ), 1, fp ) == 1 &&
+                 fwrite( all.table, sizeof( uint64_t ), all.slots, fp ) == all.slots;
+  if ( fclose( fp ) != 0 || !written )
+    fail( "Can't write the database file" );
+  free( all.table );
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  double seconds = ( end.tv_sec - begin.tv_sec ) + ( end.tv_nsec - begin.tv_nsec ) / 1e9;
+
+  // Report the size of the search and of the database.
+  fprintf( stderr, "%llu reachable positions, %llu solvable, %d symmetries, %.1f MB, %.3f seconds\n",
+           ( unsigned long long ) reachable, ( unsigned long long ) header.count, symmetry.count,
+           ( sizeof( header ) + header.slots * sizeof( uint64_t ) ) / 1048576.0, seconds );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/**
+    @file cache.h
+    @author Ian M Brain (imbrain)
+    On-disk cache of palindrome results, keyed by the engine that produced them and a hash of the input.
+    Entries are small text files under $XDG_CACHE_HOME/maxpalindrome (or ~/.cache/maxpalindrome).
+    The cache is best-effort: any failure to read or write it just means the result is computed again.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Name of the directory under the cache home that holds the entries.
+#define CACHE_DIR "maxpalindrome"
+
+// Most entries kept in the cache. The oldest entries are removed past this.
+#define CACHE_LIMIT 256
+
+// Largest result that will be stored in the cache.
+#define CACHE_ENTRY_SIZE 1024
+
+// Primes used by the hash function.
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+// Rotate a 64-bit value left.
+static inline uint64_t rotateLeft( uint64_t v, int bits ) {
+  return ( v << bits ) | ( v >> ( 64 - bits ) );
+}
+
+// Mix eight bytes of input into one of the hash lanes.
+static inline uint64_t hashRound( uint64_t acc, uint64_t input ) {
+  acc += input * HASH_PRIME2;
+  return rotateLeft( acc, 31 ) * HASH_PRIME1;
+}
+
+// Fold one lane into the combined hash.
+static inline uint64_t hashMerge( uint64_t acc, uint64_t lane ) {
+  acc ^= hashRound( 0, lane );
+  return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+// Read eight bytes of input.
+static inline uint64_t read64( unsigned char const *p ) {
+  uint64_t v;
+  memcpy( &v, p, sizeof( v ) );
+  return v;
+}
+
+/* Citing Help from outside sources
+* The hash function is XXH64 from the xxHash project by Yann Collet. It processes 32 bytes per
+* step in four independent lanes, so it runs at close to memory speed.
+*/
+// Compute a 64-bit hash of the given bytes.
+static inline uint64_t hashBytes( void const *data, size_t len, uint64_t seed ) {
+  unsigned char const *p = ( unsigned char const * ) data;
+  unsigned char const *end = p + len;
+  uint64_t h;
+
+  if ( len >= 32 ) {
+    // Run four lanes over each 32 byte stripe.
+    uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+    uint64_t v2 = seed + HASH_PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - HASH_PRIME1;
+    for ( ; p + 32 <= end; p += 32 ) {
+      v1 = hashRound( v1, read64( p ) );
+      v2 = hashRound( v2, read64( p + 8 ) );
+      v3 = hashRound( v3, read64( p + 16 ) );
+      v4 = hashRound( v4, read64( p + 24 ) );
+    }
+
+    h = rotateLeft( v1, 1 ) + rotateLeft( v2, 7 ) + rotateLeft( v3, 12 ) + rotateLeft( v4, 18 );
+    h = hashMerge( h, v1 );
+    h = hashMerge( h, v2 );
+    h = hashMerge( h, v3 );
+    h = hashMerge( h, v4 );
+  }
+  else {
+    h = seed + HASH_PRIME5;
+  }
+  h += ( uint64_t ) len;
+
+  // Mix in whatever is left, eight, four and then one byte at a time.
+  for ( ; p + 8 <= end; p += 8 ) {
+    h ^= hashRound( 0, read64( p ) );
+    h = rotateLeft( h, 27 ) * HASH_PRIME1 + HASH_PRIME4;
+  }
+  if ( p + 4 <= end ) {
+    uint32_t v;
+    memcpy( &v, p, sizeof( v ) );
+    h ^= ( uint64_t ) v * HASH_PRIME1;
+    h = rotateLeft( h, 23 ) * HASH_PRIME2 + HASH_PRIME3;
+    p += 4;
+  }
+  for ( ; p < end; p++ ) {
+    h ^= ( *p ) * HASH_PRIME5;
+    h = rotateLeft( h, 11 ) * HASH_PRIME1;
+  }
+
+  // Avalanche the final bits.
+  h ^= h >> 33;
+  h *= HASH_PRIME2;
+  h ^= h >> 29;
+  h *= HASH_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Store the path of the cache directory in path, creating it if needed. Returns false if there isn't one.
+static inline bool cacheDirectory( char *path ) {
+  // Use the XDG cache home if it is set, otherwise the default under the home directory.
+  char const *home = getenv( "XDG_CACHE_HOME" );
+  char base[ PATH_MAX ];
+  if ( home && home[ 0 ] ) {
+    snprintf( base, sizeof( base ), "%s", home );
+  }
+  else {
+    home = getenv( "HOME" );
+    if ( !home )
+      return false;
+    snprintf( base, sizeof( base ), "%s/.cache", home );
+  }
+
+  mkdir( base, 0700 );
+  if ( snprintf( path, PATH_MAX, "%s/%s", base, CACHE_DIR ) >= PATH_MAX )
+    return false;
+  return mkdir( path, 0700 ) == 0 || access( path, W_OK ) == 0;
+}
+
+// Store the path of the entry for the given engine and input hash in path.
+static inline bool cacheEntryPath( char *path, char const *engine, uint64_t hash ) {
+  char dir[ PATH_MAX ];
+  if ( !cacheDirectory( dir ) )
+    return false;
+
+  return snprintf( path, PATH_MAX, "%s/%s-%016llx", dir, engine, ( unsigned long long ) hash ) < PATH_MAX;
+}
+
+// Look up the result for the given engine and input hash. Copies it into result and returns true on a hit.
+static inline bool cacheLookup( char const *engine, uint64_t hash, char *result ) {
+  char path[ PATH_MAX ];
+  if ( !cacheEntryPath( path, engine, hash ) )
+    return false;
+
+  FILE *fp = fopen( path, "r" );
+  if ( !fp )
+    return false;
+
+  size_t len = fread( result, 1, CACHE_ENTRY_SIZE - 1, fp );
+  fclose( fp );
+  result[ len ] = '\0';
+  return len > 0;
+}
+
+// Remove the oldest entries until there is room for one more.
+static inline void cacheEvict( char const *dir ) {
+  while ( true ) {
+    DIR *dp = opendir( dir );
+    if ( !dp )
+      return;
+
+    // Count the entries and find the one modified longest ago.
+    int count = 0;
+    time_t oldest = 0;
+    char oldestPath[ PATH_MAX ] = "";
+    struct dirent *entry;
+    while ( ( entry = readdir( dp ) ) ) {
+      if ( entry->d_name[ 0 ] == '.' )
+        continue;
+
+      char path[ PATH_MAX ];
+      struct stat info;
+      if ( snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name ) >= PATH_MAX || stat( path, &info ) != 0 )
+        continue;
+
+      count++;
+      if ( oldestPath[ 0 ] == '\0' || info.st_mtime < oldest ) {
+        oldest = info.st_mtime;
+        strcpy( oldestPath, path );
+      }
+    }
+    closedir( dp );
+
+    if ( count < CACHE_LIMIT || oldestPath[ 0 ] == '\0' || unlink( oldestPath ) != 0 )
+      return;
+  }
+}
+
+// Save the result for the given engine and input hash.
+static inline void cacheStore( char const *engine, uint64_t hash, char const *result ) {
+  char dir[ PATH_MAX ];
+  char path[ PATH_MAX ];
+  if ( !cacheDirectory( dir ) || !cacheEntryPath( path, engine, hash ) )
+    return;
+
+  cacheEvict( dir );
+
+  // Write to a temporary file first so a reader never sees a partial entry.
+  char temp[ PATH_MAX + 32 ];
+  snprintf( temp, sizeof( temp ), "%s/.tmp-%d", dir, ( int ) getpid() );
+  FILE *fp = fopen( temp, "w" );
+  if ( !fp )
+    return;
+
+  bool written = fputs( result, fp ) >= 0;
+  if ( fclose( fp ) != 0 || !written || rename( temp, path ) != 0 )
+    unlink( temp );
+}
+
+// Remove every entry from the cache. Returns the number of entries removed.
+static inline int cachePrune() {
+  char dir[ PATH_MAX ];
+  if ( !cacheDirectory( dir ) )
+    return 0;
+
+  DIR *dp = opendir( dir );
+  if ( !dp )
+    return 0;
+
+  int removed = 0;
+  struct dirent *entry;
+  while ( ( entry = readdir( dp ) ) ) {
+    if ( strcmp( entry->d_name, "." ) == 0 || strcmp( entry->d_name, ".." ) == 0 )
+      continue;
+
+    char path[ PATH_MAX ];
+    if ( snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name ) < PATH_MAX && unlink( path ) == 0 )
+      removed++;
+  }
+  closedir( dp );
+
+  return removed;
+}
+
+#endif
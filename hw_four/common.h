@@ -4,16 +4,29 @@
     Common header file used to specify the puzzle board struct, semaphore name, and other variables.
 */
 
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
 // Name for the semaphore used to protect access to
-// shared state.
+// shared state, when peg is built with -DSEMAPHORE.
 #define LOCK_NAME "/imbrain-peg-lock"
 
+// Number of games the session table holds. Can be raised with -DSESSIONS=n, but peg and reset
+// must be built with the same value since it sets the size of the shared table.
+#ifndef SESSIONS
+#define SESSIONS 256
+#endif
+
+// Most lock-free pegs that can be part way through a change to one game at once.
+#define CHANGERS 32
+
 // Height and width of the playing area.
 #define GRID_SIZE 8
 
-// Length of the undo history.
-#define UNDO_SIZE 3
-
 // Direction options for the move.  These are used by two functions
 // in peg.c
 #define RIGHT_DIR 0
@@ -21,10 +34,92 @@
 #define LEFT_DIR 2
 #define UP_DIR 3
 
-struct Puzzle {
-  /** Eight by eight array representing the puzzle board. */
-  char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ];
+// Board stored one bit per cell, with cell ( r, c ) at bit r * GRID_SIZE + c.
+// Cells that are in neither set are invalid ('#').
+struct Bitboard {
+  /** Cells that hold a peg ('o'). */
+  uint64_t pegs;
+
+  /** Cells that are empty holes ('.'). */
+  uint64_t holes;
+} typedef Bitboard;
+
+// Everything about the game that changes with a move, small enough to be replaced with one
+// 16-byte compare-and-swap. The holes are the valid cells without a peg.
+struct __attribute__(( aligned( 16 ) )) GameState {
+  /** Cells that hold a peg. */
+  uint64_t pegs;
+
+  /** Journal node of the last move made, or zero at the start of the game (see journal.h). */
+  uint32_t node;
+
+  /** Journal node at the top of the stack of undone moves, or zero if there are none. With
+      REDO_MOVE set, the stack is just the move node in the other bits, so the usual single
+      undo doesn't take a node. */
+  uint32_t redo;
+} typedef GameState;
+
+// Flag on a redo stack that is a single undone move node rather than a redo node. Journal nodes
+// are numbered below it.
+#define REDO_MOVE 0x80000000u
+
+// Lock-free builds commit every change with one 16-byte compare-and-swap on the game state,
+// which x86-64 only has with cmpxchg16b. Reset must be built the same way, since it replaces
+// the game state the same way.
+#ifdef LOCKFREE
+  #ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+    #error "LOCKFREE needs a 16-byte compare-and-swap, build with -mcx16"
+  #endif
+
+// The game state as the word the compare-and-swap works on.
+union GameWord {
+  GameState game;
+  unsigned __int128 word;
+} typedef GameWord;
+#endif
 
-  /** Array containing most recent three moves. */
-  char undoHistory[ UNDO_SIZE ][ 3 + 1 ];
+// One game in the session table, on cache lines of its own so games don't slow each other down.
+struct __attribute__(( aligned( 64 ) )) Puzzle {
+  /** Robust process-shared mutex protecting changes to the game. */
+  pthread_mutex_t lock;
+
+  /** Nonzero while a reset has the session allocated. */
+  uint32_t used;
+
+  /** Number of times the session has been reset or ended, so a game can tell it was replaced. */
+  uint32_t generation;
+
+  /** Cells that are part of the eight by eight board. */
+  uint64_t valid;
+
+  /** Board at the last reset, the position before the first move. */
+  Bitboard start;
+
+  /** Journal chunk the game takes its next node from, and the offset of that node in the low
+      half (see journal.h). The game's other chunks are linked behind it. */
+  uint64_t arena;
+
+  /** Lock-free pegs part way through a change to the game, by process ID, or zero for a free
+      slot. A reset waits for them before the game's nodes are reused. */
+  pid_t changing[ CHANGERS ];
+
+  /** Seqlock version of the game state, odd while a change is being written. */
+  uint32_t sequence;
+
+  /** Current state of the game. */
+  GameState game;
 } typedef Puzzle;
+
+// Every game on the host, in one shared memory object (see transport.h).
+struct SessionTable {
+  /** Set once the reset that created the table has set up every session's lock. */
+  uint32_t ready;
+
+  /** Size of the table's shared memory object, which may be rounded up for huge pages. */
+  uint64_t size;
+
+  /** The games, indexed by session ID. */
+  Puzzle sessions[ SESSIONS ];
+} typedef SessionTable;
+
+#endif
@@ -0,0 +1,162 @@
+/**
+    @file endgame.h
+    @author Ian M Brain (imbrain)
+    Endgame database of the solvable positions of one board, built offline by build-endgame.c.
+    The file is a header followed by an open-addressing hash table of the canonical peg sets (see
+    symmetry.h) of every position reachable from the builder's start board that can still be taken
+    down to one peg. It is mapped read-only, so answering a query is one hash and a short probe.
+    Doesn't depend on common.h, so the hw_two server can use it with its own board.
+*/
+
+#ifndef ENDGAME_H
+#define ENDGAME_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symmetry.h"
+
+// Database file used when PEG_ENDGAME isn't set.
+#define ENDGAME_FILE "endgame.db"
+
+// Marks the start of a database file, and its format version.
+#define ENDGAME_MAGIC "PEGEND1"
+
+// Answers from endgameSolvable().
+#define ENDGAME_UNSOLVABLE 0
+#define ENDGAME_SOLVABLE 1
+#define ENDGAME_UNKNOWN -1
+
+// Start of a database file, followed by the table.
+struct EndgameHeader {
+  /** ENDGAME_MAGIC, with its null terminator. */
+  char magic[ 8 ];
+
+  /** Cells that are part of the board. */
+  uint64_t valid;
+
+  /** Pegs of the board the positions were reached from. */
+  uint64_t start;
+
+  /** Number of solvable positions stored. */
+  uint64_t count;
+
+  /** Number of slots in the table, a power of two. Empty slots hold zero. */
+  uint64_t slots;
+} typedef EndgameHeader;
+
+// A database mapped into memory.
+struct Endgame {
+  /** Header at the start of the mapping. */
+  EndgameHeader const *header;
+
+  /** Canonical peg sets of the solvable positions. */
+  uint64_t const *table;
+
+  /** Size of the mapping. */
+  size_t size;
+
+  /** Canonical peg set of the board the positions were reached from. */
+  uint64_t startKey;
+
+  /** Symmetries of the board, for finding the canonical form of a position. */
+  SymmetryTables symmetry;
+} typedef Endgame;
+
+// Slot where the search for a canonical peg set starts.
+static inline uint64_t endgameSlot( uint64_t key, uint64_t slots ) {
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDULL;
+  key ^= key >> 33;
+  return key & ( slots - 1 );
+}
+
+// Store a key in a table with the given number of slots. Returns false if it was already there.
+static inline bool endgameInsert( uint64_t *table, uint64_t slots, uint64_t key ) {
+  for ( uint64_t slot = endgameSlot( key, slots ); ; slot = ( slot + 1 ) & ( slots - 1 ) ) {
+    if ( table[ slot ] == key )
+      return false;
+    if ( table[ slot ] == 0 ) {
+      table[ slot ] = key;
+      return true;
+    }
+  }
+}
+
+// True if the key is in a table with the given number of slots. Stops after one pass, in case
+// the table has no empty slot.
+static inline bool endgameContains( uint64_t const *table, uint64_t slots, uint64_t key ) {
+  uint64_t slot = endgameSlot( key, slots );
+  for ( uint64_t probes = 0; probes < slots && table[ slot ]; probes++, slot = ( slot + 1 ) & ( slots - 1 ) )
+    if ( table[ slot ] == key )
+      return true;
+  return false;
+}
+
+// Path of the database file, from PEG_ENDGAME or the default.
+static inline char const *endgamePath() {
+  char const *path = getenv( "PEG_ENDGAME" );
+  return path && path[ 0 ] ? path : ENDGAME_FILE;
+}
+
+// Map the database file at path. Returns false if it can't be opened or isn't a database.
+static inline bool openEndgame( Endgame *db, char const *path ) {
+  int fd = open( path, O_RDONLY );
+  if ( fd == -1 )
+    return false;
+
+  struct stat info;
+  if ( fstat( fd, &info ) != 0 || info.st_size < 0 || ( uint64_t ) info.st_size < sizeof( EndgameHeader ) ) {
+    close( fd );
+    return false;
+  }
+  uint64_t size = info.st_size;
+
+  void *map = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED )
+    return false;
+
+  // Check the header before trusting the table size it gives. The table must also be no more than
+  // half full, as the builder leaves it, so every lookup reaches an empty slot.
+  EndgameHeader const *header = ( EndgameHeader const * ) map;
+  uint64_t slots = header->slots;
+  uint64_t tableSize = size - sizeof( EndgameHeader );
+  if ( memcmp( header->magic, ENDGAME_MAGIC, sizeof( header->magic ) ) != 0 || slots == 0 ||
+       ( slots & ( slots - 1 ) ) != 0 || tableSize % sizeof( uint64_t ) != 0 ||
+       tableSize / sizeof( uint64_t ) != slots || header->count > slots / 2 ) {
+    munmap( map, size );
+    return false;
+  }
+
+  db->header = header;
+  db->table = ( uint64_t const * ) ( header + 1 );
+  db->size = size;
+  initSymmetryTables( &db->symmetry, header->valid );
+  db->startKey = canonicalPegs( &db->symmetry, header->start );
+  return true;
+}
+
+// Unmap a database.
+static inline void closeEndgame( Endgame *db ) {
+  munmap( ( void * ) db->header, db->size );
+}
+
+// Look up whether a position of a game that began with the pegs in start can still be taken down to one
+// peg. Only positions reachable from the database's start board were enumerated, so the answer is
+// ENDGAME_UNKNOWN unless the game began from that board, or one of its rotations or reflections.
+static inline int endgameSolvable( Endgame const *db, uint64_t start, uint64_t pegs, uint64_t holes ) {
+  if ( ( pegs | holes ) != db->header->valid || ( pegs & holes ) ||
+       ( start & ~db->header->valid ) || canonicalPegs( &db->symmetry, start ) != db->startKey )
+    return ENDGAME_UNKNOWN;
+
+  uint64_t key = canonicalPegs( &db->symmetry, pegs );
+  return endgameContains( db->table, db->header->slots, key ) ? ENDGAME_SOLVABLE : ENDGAME_UNSOLVABLE;
+}
+
+#endif
@@ -0,0 +1,293 @@
+/**
+    @file journal.h
+    @author Ian M Brain (imbrain)
+    Journal of every move made in every session, kept in one POSIX shared memory object next to
+    the session table's (see transport.h). The journal is an arena of nodes that are never changed
+    while their game is in play: a move node holds a move, packed with MOVE_CODE(), and the node of
+    the move before it, and a redo node holds an undone move node and the redo node below it on the
+    stack of undone moves. The game state in the Puzzle just names the last move node and the top
+    redo node, so making, undoing or redoing a move is one new node at most and one update of the
+    game state, however long the game gets. When the arena fills up it is grown with
+    posix_fallocate, which never shrinks it, and every process remaps it the next time it needs a
+    node past its mapping.
+    Each game takes its nodes from chunks of its own, and a reset or end gives the chunks back to
+    a stack of free ones that any game can take from. Nodes are handed out and chunks moved with
+    compare-and-swaps, so the journal needs no lock of its own. A game's nodes are reused as soon
+    as it is replaced, so a peg reading them without the lock checks the generation afterwards.
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include "common.h"
+#include "transport.h"
+
+// Number of nodes the journal has room for when it is created.
+#define JOURNAL_INITIAL 4096
+
+// Number of nodes in a chunk. The first node of chunk c is node c * JOURNAL_CHUNK, and links the
+// chunk to the next one of its game, or on the free stack, so it is never handed out. Chunk zero
+// is never used, so zero can mean no chunk and no node.
+#define JOURNAL_CHUNK 64
+
+#ifdef LOCKFREE
+// Node a lock-free game names while a reset or end is replacing it. No change can be committed
+// on it, and pegs wait for the new game instead of reading it.
+#define CLOSED_NODE UINT32_MAX
+#endif
+
+// A move node, or a redo node.
+struct JournalNode {
+  /** Previous move node, or the next redo node down the stack. Zero for none. */
+  uint32_t link;
+
+  /** Code of the move, or the undone move node. */
+  uint32_t value;
+} typedef JournalNode;
+
+// Start of the journal segment, followed by the nodes.
+struct JournalHeader {
+  /** Number of nodes the segment has room for. Only grows. */
+  uint64_t capacity;
+
+  /** Number of nodes taken for chunks so far. */
+  uint64_t used;
+
+  /** Top chunk of the stack of free ones in the low half, and the number of times the stack has
+      changed in the high half, so a chunk taken and put back in between can't fool a pop. */
+  uint64_t free;
+} typedef JournalHeader;
+
+// One process's mapping of the journal.
+struct Journal {
+  /** Descriptor of the shared memory segment. */
+  int fd;
+
+  /** Header at the start of the mapping. */
+  JournalHeader *header;
+
+  /** Number of nodes the mapping covers. */
+  uint64_t mapped;
+} typedef Journal;
+
+// Size of a journal segment with room for the given number of nodes.
+static inline size_t journalSize( uint64_t capacity ) {
+  return sizeof( JournalHeader ) + capacity * sizeof( JournalNode );
+}
+
+// Map the journal segment with room for the given number of nodes.
+static inline bool mapJournal( Journal *journal, uint64_t capacity ) {
+  void *map = sharedMap( journal->fd, journalSize( capacity ), false );
+  if ( !map )
+    return false;
+
+  journal->header = ( JournalHeader * ) map;
+  journal->mapped = capacity;
+  return true;
+}
+
+// Create an empty journal, replacing any old one.
+static inline bool createJournal( Journal *journal ) {
+  char name[ SHARED_NAME_SIZE ];
+  journal->fd = shm_open( sharedName( name, JOURNAL_SUFFIX ), O_RDWR | O_CREAT | O_TRUNC, 0666 );
+  if ( journal->fd == -1 || ftruncate( journal->fd, journalSize( JOURNAL_INITIAL ) ) != 0 ||
+       !mapJournal( journal, JOURNAL_INITIAL ) )
+    return false;
+
+  journal->header->capacity = JOURNAL_INITIAL;
+  journal->header->used = JOURNAL_CHUNK;
+  journal->header->free = 0;
+  return true;
+}
+
+// Map the journal made by the first reset.
+static inline bool openJournal( Journal *journal ) {
+  struct stat info;
+  char name[ SHARED_NAME_SIZE ];
+  journal->fd = shm_open( sharedName( name, JOURNAL_SUFFIX ), O_RDWR, 0 );
+  if ( journal->fd == -1 || fstat( journal->fd, &info ) != 0 || ( size_t ) info.st_size < journalSize( 1 ) )
+    return false;
+
+  return mapJournal( journal, ( info.st_size - sizeof( JournalHeader ) ) / sizeof( JournalNode ) );
+}
+
+// Get a node, remapping the journal first if it has grown past this process's mapping.
+// Returns NULL if it can't be mapped, leaving the old mapping in place.
+static inline JournalNode *journalNode( Journal *journal, uint32_t index ) {
+  if ( index >= journal->mapped ) {
+    uint64_t capacity = __atomic_load_n( &journal->header->capacity, __ATOMIC_ACQUIRE );
+    if ( index >= capacity )
+      return NULL;
+
+    // Only give up the old mapping once the larger one is in place.
+    JournalHeader *old = journal->header;
+    uint64_t oldMapped = journal->mapped;
+    if ( !mapJournal( journal, capacity ) )
+      return NULL;
+    munmap( old, journalSize( oldMapped ) );
+  }
+
+  return ( JournalNode * ) ( journal->header + 1 ) + index;
+}
+
+// Take a chunk off the free stack, or a new one off the end of the journal, growing it if it is
+// full. Returns the chunk's number, or zero if the journal can't grow.
+static inline uint32_t takeChunk( Journal *journal ) {
+  uint64_t top = __atomic_load_n( &journal->header->free, __ATOMIC_ACQUIRE );
+  while ( ( uint32_t ) top ) {
+    // The link may be stale if another process takes the chunk first, but then the count changed.
+    JournalNode *head = journalNode( journal, ( uint32_t ) top * JOURNAL_CHUNK );
+    if ( !head )
+      return 0;
+    uint64_t next = ( ( top >> 32 ) + 1 ) << 32 | head->link;
+    if ( __atomic_compare_exchange_n( &journal->header->free, &top, next, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+      return ( uint32_t ) top;
+  }
+
+  uint64_t index = __atomic_fetch_add( &journal->header->used, JOURNAL_CHUNK, __ATOMIC_ACQ_REL );
+  if ( index + JOURNAL_CHUNK > REDO_MOVE )
+    return 0;
+
+  // Double the segment until the new chunk fits. Other processes may be growing it at the same
+  // time, but posix_fallocate only ever adds space, and the larger capacity always wins.
+  uint64_t capacity = __atomic_load_n( &journal->header->capacity, __ATOMIC_ACQUIRE );
+  while ( index + JOURNAL_CHUNK > capacity ) {
+    uint64_t grown = capacity * 2;
+    if ( posix_fallocate( journal->fd, 0, journalSize( grown ) ) != 0 )
+      return 0;
+
+    // On failure this picks up the capacity another process set.
+    if ( __atomic_compare_exchange_n( &journal->header->capacity, &capacity, grown, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+      capacity = grown;
+  }
+
+  return journalNode( journal, index ) ? index / JOURNAL_CHUNK : 0;
+}
+
+// Put a list of chunks, linked through their first nodes from first to last, on the free stack.
+static inline void giveChunks( Journal *journal, uint32_t first, uint32_t last ) {
+  JournalNode *tail = journalNode( journal, last * JOURNAL_CHUNK );
+  if ( !tail )
+    return;
+
+  uint64_t top = __atomic_load_n( &journal->header->free, __ATOMIC_ACQUIRE );
+  do {
+    tail->link = ( uint32_t ) top;
+  } while ( !__atomic_compare_exchange_n( &journal->header->free, &top, ( ( top >> 32 ) + 1 ) << 32 | first,
+                                          false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) );
+}
+
+// Hand out a new node from a game's arena, starting a new chunk when the last one is used up.
+// Returns zero if the journal is full.
+static inline uint32_t journalAlloc( Journal *journal, uint64_t *arena ) {
+  uint64_t current = __atomic_load_n( arena, __ATOMIC_ACQUIRE );
+  while ( true ) {
+    uint32_t chunk = current >> 32;
+    uint32_t offset = ( uint32_t ) current;
+    if ( chunk && offset < JOURNAL_CHUNK ) {
+      if ( __atomic_compare_exchange_n( arena, &current, current + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+        return chunk * JOURNAL_CHUNK + offset;
+      continue;
+    }
+
+    // Link a new chunk in front of the game's others, so they can all be given back together.
+    uint32_t fresh = takeChunk( journal );
+    JournalNode *head = fresh ? journalNode( journal, fresh * JOURNAL_CHUNK ) : NULL;
+    if ( !head )
+      return 0;
+    head->link = chunk;
+
+    // Put it back if another process started a chunk for the game first.
+    if ( __atomic_compare_exchange_n( arena, &current, ( uint64_t ) fresh << 32 | 2, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+      return fresh * JOURNAL_CHUNK + 1;
+    giveChunks( journal, fresh, fresh );
+  }
+}
+
+// Give every chunk of an arena taken off a game back to the free stack.
+static inline void journalFree( Journal *journal, uint64_t arena ) {
+  uint32_t first = arena >> 32;
+  if ( !first )
+    return;
+
+  // Find the game's first chunk, at the end of the list.
+  uint32_t last = first;
+  for ( JournalNode *head; ( head = journalNode( journal, last * JOURNAL_CHUNK ) ) && head->link; )
+    last = head->link;
+
+  giveChunks( journal, first, last );
+}
+
+// Put a new game in a session in place of the old one, on the board start if it isn't NULL, and
+// give the old game's nodes back to the journal. The caller holds the session's lock and has made the sequence odd, so no peg with a
+// lock is using the nodes. Lock-free pegs are told to give up on the old game first, and the
+// generation changes before any node is reused, for the pegs reading nodes without the lock.
+static inline void replaceGame( Journal *journal, Puzzle *state, GameState game, Bitboard const *start ) {
+  #ifdef LOCKFREE
+    // Swap the closed game in the way pegs commit changes, then wait for the pegs that were
+    // changing the old game to see it. One that died part way never will, so its slot is cleared.
+    GameWord current, closed = { { 0, CLOSED_NODE, 0 } };
+    current.word = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game, 0, 0 );
+    while ( true ) {
+      unsigned __int128 seen = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game,
+                                                            current.word, closed.word );
+      if ( seen == current.word )
+        break;
+      current.word = seen;
+    }
+
+    for ( int i = 0; i < CHANGERS; i++ ) {
+      pid_t pid;
+      while ( ( pid = __atomic_load_n( &state->changing[ i ], __ATOMIC_SEQ_CST ) ) ) {
+        if ( kill( pid, 0 ) != 0 && errno == ESRCH )
+          __atomic_compare_exchange_n( &state->changing[ i ], &pid, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED );
+        else
+          sched_yield();
+      }
+    }
+  #endif
+
+  // No peg is changing the game now, so the board can change shape under it. Readers copying
+  // the board see the generation change after it.
+  if ( start ) {
+    __atomic_store_n( &state->valid, start->pegs | start->holes, __ATOMIC_RELAXED );
+    __atomic_store_n( &state->start.pegs, start->pegs, __ATOMIC_RELAXED );
+    __atomic_store_n( &state->start.holes, start->holes, __ATOMIC_RELAXED );
+  }
+
+  __atomic_fetch_add( &state->generation, 1, __ATOMIC_SEQ_CST );
+  uint64_t arena = __atomic_exchange_n( &state->arena, 0, __ATOMIC_ACQ_REL );
+
+  #ifdef LOCKFREE
+    GameWord desired;
+    desired.game = game;
+    __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game, closed.word, desired.word );
+  #else
+    __atomic_store_n( &state->game.pegs, game.pegs, __ATOMIC_RELAXED );
+    __atomic_store_n( &state->game.node, game.node, __ATOMIC_RELAXED );
+    __atomic_store_n( &state->game.redo, game.redo, __ATOMIC_RELAXED );
+  #endif
+
+  journalFree( journal, arena );
+}
+
+// Unmap the journal.
+static inline void closeJournal( Journal *journal ) {
+  munmap( journal->header, journalSize( journal->mapped ) );
+  close( journal->fd );
+}
+
+#endif
@@ -6,6 +6,15 @@
     As characters are read, worker threads begin to search for palindromes in the string.
     Utilizes anonymous semaphores to provide mutual exclusion.
     Prints the maximum semaphore length and can optionally print a report of semaphores found from each thread.
+    The suffix engine instead builds a suffix array over the whole sequence and also reports the
+    longest repeated substring and the longest common substring with the reversed sequence.
+    With the mismatches option, the suffix array is used to find the longest palindrome that has
+    up to K mismatched pairs of characters.
+    The normalize option folds case and drops non-letters as the input is loaded, and reports a
+    histogram of the symbols that were kept.
+    With the cache option, results are cached on disk keyed by the engine and a hash of the
+    loaded input, so identical inputs are answered without searching again. The lookup needs the
+    whole input first, so it costs the streaming workers their head start.
 */
 
 #include <stdlib.h>
@@ -16,7 +25,11 @@
 #include <pthread.h>
 #include <limits.h>
 #include <semaphore.h>
+#include <stdarg.h>
 #include <sys/syscall.h>
+#include "suffix.h"
+#include "normalize.h"
+#include "cache.h"
 
 // Print out an error message and exit.
 static void fail( char const *message ) {
@@ -28,12 +41,57 @@ static void fail( char const *message ) {
 static void usage() {
   printf( "usage: maxpalindrome-sem <workers>\n" );
   printf( "       maxpalindrome-sem <workers> report\n" );
+  printf( "       maxpalindrome-sem <workers> [report] suffix\n" );
+  printf( "       maxpalindrome-sem <workers> [report] [suffix] mismatches <K>\n" );
+  printf( "       maxpalindrome-sem <workers> [options] normalize [remap <from><to>]...\n" );
+  printf( "       maxpalindrome-sem <workers> [options] cache\n" );
+  printf( "       maxpalindrome-sem <workers> prunecache\n" );
   exit( 1 );
 }
 
 // True if we're supposed to report what we find.
 bool report = false;
 
+// True if the suffix array engine should be used instead of the streaming workers.
+bool suffixEngine = false;
+
+// Number of mismatched pairs allowed in a palindrome, or -1 if only exact palindromes are wanted.
+int mismatches = -1;
+
+// True if the input should be normalized as it is loaded.
+bool normalize = false;
+
+// Normalization table and symbol histogram used when loading the input.
+Normalizer normalizer;
+
+// True if results should be looked up in and saved to the cache.
+bool useCache = false;
+
+// Name of the engine and options that produce the results, used as part of the cache key.
+char engineKey[ 64 ] = "";
+
+// Hash of the loaded input, used as the rest of the cache key.
+uint64_t inputHash = 0;
+
+// Summary of the results, which is what gets cached.
+char results[ CACHE_ENTRY_SIZE ] = "";
+
+// Add a line to the summary of the results.
+void addResult( char const *format, ... ) {
+  va_list args;
+  va_start( args, format );
+  int len = strlen( results );
+  vsnprintf( results + len, sizeof( results ) - len, format, args );
+  va_end( args );
+}
+
+// Print the summary of the results and save it in the cache.
+void finishResults() {
+  printf( "%s", results );
+  if ( useCache )
+    cacheStore( engineKey, inputHash, results );
+}
+
 // Maximum length we've found.
 int global_max = 0;
 
@@ -67,20 +125,53 @@ sem_t buffer_index_sem;
 // Semaphore to ensure that multiple threads do not print at the same time, messing up the format of output
 sem_t print_sem;
 
-// Read the list of values.
-void readList() {
-  // Keep reading as many values as we can.
-  char v;
-  while ( scanf( "%c\n", &v ) == 1 ) {
-    // Make sure we have enough room, then store the latest input.
-    if ( vCount > MAX_VALUES )
+// Number of bytes read from the input at a time when normalizing.
+#define READ_BLOCK 65536
+
+// Block of raw input waiting to be normalized.
+unsigned char readBlock[ READ_BLOCK ];
+
+// Normalized characters from the current block.
+char normalizedBlock[ READ_BLOCK + NORMALIZE_SLACK ];
+
+// Read the list of values in blocks, normalizing each block as it is read.
+void readNormalizedList() {
+  size_t len;
+  while ( ( len = fread( readBlock, 1, READ_BLOCK, stdin ) ) > 0 ) {
+    int count = normalizeBlock( &normalizer, readBlock, len, normalizedBlock );
+
+    // Make sure we have enough room, then store the block.
+    if ( vCount + count > MAX_VALUES )
       fail( "Too many input values" );
+    memcpy( vList + vCount, normalizedBlock, count );
 
-    // Store the latest value.
-    vList[ vCount++ ] = v;
+    // Release the semaphore once for each new value.
+    for ( int i = 0; i < count; i++ ) {
+      vCount++;
+      sem_post( &buffer_sem );
+    }
+  }
+}
 
-    // Release the semaphore indicating there is more work
-    sem_post( &buffer_sem );
+// Read the list of values.
+void readList() {
+  if ( normalize ) {
+    readNormalizedList();
+  }
+  else {
+    // Keep reading as many values as we can.
+    char v;
+    while ( scanf( "%c\n", &v ) == 1 ) {
+      // Make sure we have enough room, then store the latest input.
+      if ( vCount > MAX_VALUES )
+        fail( "Too many input values" );
+
+      // Store the latest value.
+      vList[ vCount++ ] = v;
+
+      // Release the semaphore indicating there is more work
+      sem_post( &buffer_sem );
+    }
   }
 
   // Indicate that reading values is finished.
@@ -209,12 +300,116 @@ void *workerRoutine( void *arg ) {
   return NULL;
 }
 
+// Suffix array index over the sequence, used by the suffix engine.
+SuffixIndex suffixIndex;
+
+// Start routine for each suffix engine worker. Checks every center in the worker's share of the sequence.
+void *suffixRoutine( void *arg ) {
+  // Which worker this is.
+  int worker = *( int * ) arg;
+
+  // Longest palindrome found by the worker thread and where it starts.
+  int longestPalindrome = 0;
+  int firstChar = 0;
+
+  // Check each center in the worker's share. There are two centers for every character but the last.
+  int centers = 2 * vCount - 1;
+  int end = chunkStart( centers, worker + 1, global_workers );
+  for ( int center = chunkStart( centers, worker, global_workers ); center < end; center++ ) {
+    int start = 0;
+    int length = mismatches > 0 ? approximatePalindromeAt( &suffixIndex, center, mismatches, &start )
+                                : palindromeAt( &suffixIndex, center, &start );
+    if ( length > longestPalindrome ) {
+      longestPalindrome = length;
+      firstChar = start;
+    }
+  }
+
+  // Update the global maximum palindrome with the longest recorded length.
+  sem_wait( &max_sem );
+  if( longestPalindrome >= global_max ) {
+    global_max = longestPalindrome;
+  }
+  sem_post( &max_sem );
+
+  // If report is specified print out the longest palindrome found.
+  if ( report ) {
+    sem_wait( &print_sem );
+    printf( "I'm thread %d. ", ( int ) syscall(__NR_gettid) );
+    printf( "Max length found: %d. ", longestPalindrome );
+    printf( "Sequence is: %.*s.\n", longestPalindrome, vList + firstChar );
+    sem_post( &print_sem );
+  }
+
+  return NULL;
+}
+
+// Find the longest (or approximate) palindrome, and for the suffix engine the longest repeat and
+// longest common substring with the reverse, using a suffix array.
+void runSuffixEngine( int workers ) {
+  // After normalizing, the histogram lets the index use only the symbols that occur.
+  if ( normalize ) {
+    int symbolMap[ 256 ];
+    int alphabet = packSymbols( &normalizer, symbolMap );
+    buildSuffixIndex( &suffixIndex, vList, vCount, workers, symbolMap, alphabet );
+  }
+  else {
+    buildSuffixIndex( &suffixIndex, vList, vCount, workers, NULL, 0 );
+  }
+
+  // Search the centers in parallel.
+  pthread_t worker[ workers ];
+  int workerIndex[ workers ];
+  for ( int i = 0; i < workers; i++ ) {
+    workerIndex[ i ] = i;
+    if ( pthread_create( &(worker[ i ]), NULL, suffixRoutine, &( workerIndex[ i ] ) ) != 0 )
+      fail( "Cannot create worker thread\n" );
+  }
+
+  for ( int i = 0; i < workers; i++ )
+    pthread_join( worker[ i ], NULL );
+
+  // The approximate search on its own only reports the palindrome length.
+  if ( !suffixEngine ) {
+    addResult( "Maximum Length: %d\n", global_max );
+    finishResults();
+    freeSuffixIndex( &suffixIndex );
+    return;
+  }
+
+  // The repeat queries are single scans over the LCP array.
+  int repeatStart = 0;
+  int repeatLength = longestRepeat( &suffixIndex, &repeatStart );
+  int commonStart = 0;
+  int commonLength = longestCommonWithReverse( &suffixIndex, &commonStart );
+
+  addResult( "Maximum Length: %d\n", global_max );
+  addResult( "Longest Repeat: %d\n", repeatLength );
+  addResult( "Longest Common With Reverse: %d\n", commonLength );
+  finishResults();
+
+  // Report the substrings themselves if requested.
+  if ( report ) {
+    printf( "Repeat is: %.*s.\n", repeatLength, vList + repeatStart );
+    printf( "Common with reverse is: %.*s.\n", commonLength, vList + commonStart );
+  }
+
+  freeSuffixIndex( &suffixIndex );
+}
+
+// Print how many times each symbol was kept while normalizing the input.
+void reportHistogram() {
+  for ( int i = 0; i < 256; i++ )
+    if ( normalizer.histogram[ i ] )
+      printf( "Symbol %c: %ld\n", i, normalizer.histogram[ i ] );
+}
+
 int main( int argc, char *argv[] ) {
   // Number of workers the user selects.
   int workers = 4;
   
   // Parse command-line arguments.
-  if ( argc < 2 || argc > 3 )
+  if ( argc < 2 )
     usage();
   
   if ( sscanf( argv[ 1 ], "%d", &workers ) != 1 ||
@@ -233,11 +428,79 @@ int main( int argc, char *argv[] ) {
   // Initialize the print index sempahore to 1.
   sem_init( &print_sem, 0, 1 );
 
-  // If there's a second argument, it better be "report"
-  if ( argc == 3 ) {
-    if ( strcmp( argv[ 2 ], "report" ) != 0 )
+  // Letter pairs given with the remap option.
+  char *remaps[ argc ];
+  int remapCount = 0;
+
+  // Any remaining arguments must be "report", the engine to use or a normalization option.
+  for ( int i = 2; i < argc; i++ ) {
+    if ( strcmp( argv[ i ], "report" ) == 0 )
+      report = true;
+    else if ( strcmp( argv[ i ], "suffix" ) == 0 )
+      suffixEngine = true;
+    else if ( strcmp( argv[ i ], "mismatches" ) == 0 ) {
+      // The number of mismatches follows the option.
+      if ( i + 1 >= argc || sscanf( argv[ i + 1 ], "%d", &mismatches ) != 1 || mismatches < 0 )
+        usage();
+      i++;
+    }
+    else if ( strcmp( argv[ i ], "normalize" ) == 0 )
+      normalize = true;
+    else if ( strcmp( argv[ i ], "remap" ) == 0 ) {
+      // The letter to remap and its replacement follow the option.
+      if ( i + 1 >= argc || strlen( argv[ i + 1 ] ) != 2 )
+        usage();
+      remaps[ remapCount++ ] = argv[ ++i ];
+    }
+    else if ( strcmp( argv[ i ], "cache" ) == 0 )
+      useCache = true;
+    // Caching used to be on unless this was given, so it is still accepted.
+    else if ( strcmp( argv[ i ], "nocache" ) == 0 )
+      useCache = false;
+    else if ( strcmp( argv[ i ], "prunecache" ) == 0 ) {
+      // Empty the cache and exit without reading any input.
+      printf( "Removed %d cache entries\n", cachePrune() );
+      return EXIT_SUCCESS;
+    }
+    else
       usage();
-    report = true;
+  }
+
+  // Set up the normalizer once all the remaps are known.
+  initNormalizer( &normalizer );
+  for ( int i = 0; i < remapCount; i++ )
+    if ( !addRemap( &normalizer, remaps[ i ][ 0 ], remaps[ i ][ 1 ] ) )
+      usage();
+
+  // The engine and its options are part of the cache key.
+  if ( suffixEngine )
+    strcpy( engineKey, "suffix" );
+  else if ( mismatches >= 0 )
+    strcpy( engineKey, "approx" );
+  else
+    strcpy( engineKey, "sem" );
+  if ( mismatches >= 0 )
+    sprintf( engineKey + strlen( engineKey ), "-k%d", mismatches );
+
+  // The suffix and mismatch engines need the whole input, and so does the cache lookup.
+  bool preload = useCache || suffixEngine || mismatches >= 0;
+  if ( preload ) {
+    readList();
+    inputHash = hashBytes( vList, vCount, 0 );
+
+    // The per-thread report can't be replayed from the cache, so only look up plain runs.
+    if ( useCache && !report && cacheLookup( engineKey, inputHash, results ) ) {
+      printf( "%s", results );
+      return EXIT_SUCCESS;
+    }
+  }
+
+  // The suffix and mismatch engines do not need the streaming workers.
+  if ( suffixEngine || mismatches >= 0 ) {
+    runSuffixEngine( workers );
+    if ( normalize && report )
+      reportHistogram();
+    return EXIT_SUCCESS;
   }
 
   // Make each of the workers.
@@ -252,8 +515,9 @@ int main( int argc, char *argv[] ) {
     if ( pthread_create( &(worker[ i ]), NULL, workerRoutine, NULL ) != 0 ) 
       fail( "Cannot create worker thread\n" );
 
-  // Then, start getting work for them to do.
-  readList();
+  // Then, start getting work for them to do, unless the input is already loaded.
+  if ( !preload )
+    readList();
 
   // Wait until all the workers finish.
   for ( int i = 0; i < workers; i++ ) {
@@ -263,7 +527,12 @@ int main( int argc, char *argv[] ) {
   }
 
   // Report the max and release the semaphores.
-  printf( "Maximum Length: %d\n", global_max );
+  addResult( "Maximum Length: %d\n", global_max );
+  finishResults();
+
+  // Report the symbols that were kept if the input was normalized.
+  if ( normalize && report )
+    reportHistogram();
   
   return EXIT_SUCCESS;
 }
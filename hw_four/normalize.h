@@ -0,0 +1,135 @@
+/**
+    @file normalize.h
+    @author Ian M Brain (imbrain)
+    Normalization of sequences as they are loaded by the palindrome programs.
+    Upper case letters are folded to lower case, every byte that is not a letter is dropped
+    (newlines, stray carriage returns, digits, punctuation) and letters can be remapped to other letters.
+    Input is processed in bulk blocks. On processors with SSSE3, sixteen bytes are folded and
+    classified at a time and the kept bytes are packed together with shuffle masks looked up in a table.
+    A histogram of the resulting symbols is kept so callers can pack the alphabet down to the
+    symbols that actually occur.
+*/
+
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <stdbool.h>
+#include <string.h>
+#include <tmmintrin.h>
+
+// Number of extra bytes the output of normalizeBlock() may be written past its returned length.
+#define NORMALIZE_SLACK 16
+
+struct Normalizer {
+  /** Letter each lower case letter is remapped to. */
+  unsigned char remap[ 256 ];
+
+  /** Number of times each symbol has been produced. */
+  long histogram[ 256 ];
+
+  /** Shuffle masks that pack the kept bytes of an eight byte group, indexed by the keep mask. */
+  unsigned char pack[ 256 ][ 8 ];
+
+  /** True if the processor supports the vectorized path. */
+  bool vectorized;
+} typedef Normalizer;
+
+// Set up a normalizer with no remapped letters and an empty histogram.
+static inline void initNormalizer( Normalizer *norm ) {
+  for ( int i = 0; i < 256; i++ )
+    norm->remap[ i ] = i;
+  memset( norm->histogram, 0, sizeof( norm->histogram ) );
+
+  // For each keep mask, list the positions of the set bits, in order.
+  for ( int mask = 0; mask < 256; mask++ ) {
+    int count = 0;
+    for ( int bit = 0; bit < 8; bit++ )
+      if ( mask & ( 1 << bit ) )
+        norm->pack[ mask ][ count++ ] = bit;
+    while ( count < 8 )
+      norm->pack[ mask ][ count++ ] = 0x80;
+  }
+
+  norm->vectorized = __builtin_cpu_supports( "ssse3" );
+}
+
+// Remap a letter (in either case) to another letter. Returns false if either one isn't a letter.
+static inline bool addRemap( Normalizer *norm, char from, char to ) {
+  from |= 0x20;
+  to |= 0x20;
+  if ( from < 'a' || from > 'z' || to < 'a' || to > 'z' )
+    return false;
+
+  norm->remap[ ( unsigned char ) from ] = to;
+  return true;
+}
+
+// Fold, filter and pack the input without vector instructions. Returns the number of bytes stored in out.
+static inline int normalizeScalar( unsigned char const *in, int len, char *out ) {
+  int count = 0;
+  for ( int i = 0; i < len; i++ ) {
+    unsigned char v = in[ i ] | 0x20;
+    if ( v >= 'a' && v <= 'z' )
+      out[ count++ ] = v;
+  }
+
+  return count;
+}
+
+// Fold, filter and pack sixteen bytes at a time. Returns the number of bytes stored in out.
+__attribute__(( target( "ssse3" ) ))
+static inline int normalizeVector( Normalizer const *norm, unsigned char const *in, int len, char *out ) {
+  __m128i lowerA = _mm_set1_epi8( 'a' - 1 );
+  __m128i lowerZ = _mm_set1_epi8( 'z' + 1 );
+  __m128i caseBit = _mm_set1_epi8( 0x20 );
+  __m128i highHalf = _mm_set_epi8( 8, 8, 8, 8, 8, 8, 8, 8, 0, 0, 0, 0, 0, 0, 0, 0 );
+
+  int count = 0;
+  int i = 0;
+  for ( ; i + 16 <= len; i += 16 ) {
+    // Fold to lower case. Bytes at or above 0x80 compare as negative and are never kept.
+    __m128i v = _mm_or_si128( _mm_loadu_si128( ( __m128i const * ) ( in + i ) ), caseBit );
+    __m128i keep = _mm_and_si128( _mm_cmpgt_epi8( v, lowerA ), _mm_cmplt_epi8( v, lowerZ ) );
+    int mask = _mm_movemask_epi8( keep );
+
+    // Pack each half with its shuffle mask. The high half's indices are offset to its bytes.
+    __m128i shuffle = _mm_unpacklo_epi64( _mm_loadl_epi64( ( __m128i const * ) norm->pack[ mask & 0xFF ] ),
+                                          _mm_loadl_epi64( ( __m128i const * ) norm->pack[ mask >> 8 ] ) );
+    __m128i packed = _mm_shuffle_epi8( v, _mm_add_epi8( shuffle, highHalf ) );
+
+    // Store both halves, each one right after the kept bytes of the previous one.
+    _mm_storel_epi64( ( __m128i * ) ( out + count ), packed );
+    count += __builtin_popcount( mask & 0xFF );
+    _mm_storel_epi64( ( __m128i * ) ( out + count ), _mm_srli_si128( packed, 8 ) );
+    count += __builtin_popcount( mask >> 8 );
+  }
+
+  // Handle the bytes left over after the last full block.
+  return count + normalizeScalar( in + i, len - i, out + count );
+}
+
+// Normalize a block of input into out, which must have room for len + NORMALIZE_SLACK bytes.
+// Remaps the kept letters, counts them in the histogram and returns how many there are.
+static inline int normalizeBlock( Normalizer *norm, unsigned char const *in, int len, char *out ) {
+  int count = norm->vectorized ? normalizeVector( norm, in, len, out ) : normalizeScalar( in, len, out );
+
+  for ( int i = 0; i < count; i++ ) {
+    unsigned char v = norm->remap[ ( unsigned char ) out[ i ] ];
+    out[ i ] = v;
+    norm->histogram[ v ]++;
+  }
+
+  return count;
+}
+
+// Fill in symbolMap with a dense code for each symbol that appears in the histogram.
+// Returns the number of distinct symbols.
+static inline int packSymbols( Normalizer const *norm, int *symbolMap ) {
+  int alphabet = 0;
+  for ( int i = 0; i < 256; i++ )
+    symbolMap[ i ] = norm->histogram[ i ] ? alphabet++ : 0;
+
+  return alphabet;
+}
+
+#endif
@@ -9,7 +9,7 @@
 #include <sys/shm.h>
 #include <errno.h>
 #include <string.h>
-#include "common.h"
+#include "oldCommon.h"
 #include <semaphore.h>
 
 /** Sempahore to provide mutual exclusion for different commands. */
@@ -8,7 +8,7 @@
 #include <sys/shm.h>
 #include <errno.h>
 #include <string.h>
-#include "common.h"
+#include "oldCommon.h"
 #include <semaphore.h>
 
 // Print out an error message and exit.
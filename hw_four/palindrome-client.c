@@ -0,0 +1,88 @@
+/**
+    @file palindrome-client.c
+    @author Ian M Brain (imbrain)
+    This program is a client for the palindromed.c query server.
+    Sends the command given on the command line and prints the reply. With no command, sends each
+    line of standard input over the same connection and prints the replies as they arrive.
+    Interacts with palindromed.c through a UNIX domain socket.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Longest command line sent to the server.
+#define LINE_LIMIT 4096
+
+// Print out an error message and exit.
+static void fail( char const *message ) {
+  fprintf( stderr, "%s\n", message );
+  exit( 1 );
+}
+
+// Print out a usage message, then exit.
+static void usage() {
+  fprintf( stderr, "usage: palindrome-client <socket> [load <file> [normalize] | max <file> |\n" );
+  fprintf( stderr, "                          top <file> <k> | range <file> <start> <end> |\n" );
+  fprintf( stderr, "                          unload <file> | stats]\n" );
+  exit( 1 );
+}
+
+int main( int argc, char *argv[] ) {
+  if ( argc < 2 )
+    usage();
+
+  // Connect to the server.
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  if ( strlen( argv[ 1 ] ) >= sizeof( addr.sun_path ) )
+    fail( "Socket path is too long" );
+  strcpy( addr.sun_path, argv[ 1 ] );
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( fd == -1 || connect( fd, ( struct sockaddr * ) &addr, sizeof( addr ) ) != 0 )
+    fail( "Can't connect to the server" );
+
+  // Commands to send, either from the command line or from standard input.
+  char line[ LINE_LIMIT ] = "";
+  if ( argc > 2 ) {
+    for ( int i = 2; i < argc; i++ ) {
+      if ( strlen( line ) + strlen( argv[ i ] ) + 2 > sizeof( line ) )
+        fail( "Command is too long" );
+      strcat( line, argv[ i ] );
+      strcat( line, i + 1 < argc ? " " : "\n" );
+    }
+
+    if ( write( fd, line, strlen( line ) ) != ( ssize_t ) strlen( line ) )
+      fail( "Unable to send command" );
+  }
+  else {
+    // Send the commands without waiting for each reply, the server replies to each in order.
+    char reply[ LINE_LIMIT ];
+    while ( fgets( line, sizeof( line ), stdin ) ) {
+      if ( write( fd, line, strlen( line ) ) != ( ssize_t ) strlen( line ) )
+        fail( "Unable to send command" );
+
+      // Print any replies that are already here, so the server never blocks on a full socket.
+      int len;
+      while ( ( len = recv( fd, reply, sizeof( reply ), MSG_DONTWAIT ) ) > 0 )
+        fwrite( reply, 1, len, stdout );
+    }
+  }
+
+  // No more commands, so the server closes the connection after the last reply.
+  shutdown( fd, SHUT_WR );
+
+  // Print the replies.
+  char reply[ LINE_LIMIT ];
+  int len;
+  while ( ( len = read( fd, reply, sizeof( reply ) ) ) > 0 )
+    fwrite( reply, 1, len, stdout );
+
+  close( fd );
+  return EXIT_SUCCESS;
+}
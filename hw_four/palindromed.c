@@ -0,0 +1,653 @@
+/**
+    @file palindromed.c
+    @author Ian M Brain (imbrain)
+    This program is a long-running palindrome query server.
+    Sequences are loaded once and indexed with the suffix array from suffix.h, which gives the length of
+    the longest palindrome at every center. The index then answers max, top-k and range queries directly.
+    Clients connect over a UNIX domain socket and send one command per line, getting one line back for each.
+    Connections are handed to a fixed pool of worker threads through anonymous semaphores, the same way
+    maxpalindrome-sem.c hands out work.
+    Loaded sequences are kept within a memory budget, evicting the least recently used one when a new
+    sequence does not fit. Room for a sequence is made from the size of its file before its index is built,
+    and requests for a sequence that is still loading wait for it rather than building it again.
+    Each worker serves one connection until the client disconnects, so at most <workers> clients are
+    served at once and the rest wait in the queue until a connection closes.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "suffix.h"
+#include "normalize.h"
+
+// Print out an error message and exit.
+static void fail( char const *message ) {
+  fprintf( stderr, "%s\n", message );
+  exit( EXIT_FAILURE );
+}
+
+// Print out a usage message, then exit.
+static void usage() {
+  printf( "usage: palindromed <socket> <workers> <budget-MB>\n" );
+  printf( "       at most <workers> clients are connected at once, others wait until one disconnects\n" );
+  exit( 1 );
+}
+
+// Longest command line accepted from a client.
+#define LINE_LIMIT 4096
+
+// Most sequences that can be loaded at once.
+#define MAX_SEQUENCES 64
+
+// Most connections waiting for a worker.
+#define QUEUE_SIZE 64
+
+// Most results returned by a top query.
+#define MAX_TOP 100
+
+// Largest sequence file that can be loaded, so the index over it still has int positions.
+#define MAX_FILE_SIZE ( ( INT_MAX - 2 ) / 2 )
+
+// A loaded sequence and its palindrome index.
+struct Sequence {
+  /** File the sequence was loaded from, empty if the slot is free. */
+  char path[ LINE_LIMIT ];
+
+  /** True if the sequence was normalized as it was loaded. */
+  bool normalized;
+
+  /** Characters of the sequence. */
+  char *seq;
+
+  /** Number of characters in the sequence. */
+  int len;
+
+  /** Length of the longest palindrome at each of the 2 * len - 1 centers. */
+  int *lengths;
+
+  /** Center of the longest palindrome in the whole sequence. */
+  int maxCenter;
+
+  /** Bytes of memory used by the sequence and its index. */
+  long bytes;
+
+  /** Value of the use clock the last time the sequence was queried. */
+  long lastUsed;
+
+  /** Number of queries currently using the sequence. It can't be evicted while this is non-zero. */
+  int users;
+
+  /** True while a worker is building the index. Only that worker touches the sequence and lengths until then. */
+  bool loading;
+
+  /** Number of requests waiting for the sequence to finish loading. */
+  int waiting;
+
+  /** Semaphore posted once for each waiting request when loading finishes. */
+  sem_t ready_sem;
+} typedef Sequence;
+
+// Table of loaded sequences.
+Sequence sequences[ MAX_SEQUENCES ];
+
+// Clock that advances on every use of a sequence, used to find the least recently used one.
+long useClock = 0;
+
+// Total bytes used by the loaded sequences.
+long memoryUsed = 0;
+
+// Most bytes the loaded sequences may use.
+long memoryBudget = 0;
+
+// Number of threads used to build each index.
+int global_workers = 0;
+
+// Semaphore to control mutual exclusion to the sequence table.
+sem_t table_sem;
+
+// Connections waiting for a worker, as a circular queue.
+int connQueue[ QUEUE_SIZE ];
+
+// Index of the next connection to hand out, and the next free slot.
+int queueHead = 0;
+int queueTail = 0;
+
+// Semaphore counting the connections waiting in the queue.
+sem_t conn_sem;
+
+// Semaphore counting the free slots in the queue.
+sem_t slot_sem;
+
+// Semaphore to ensure non-concurrent updates to the queue indices.
+sem_t queue_sem;
+
+// Flag for telling the server to stop running because of a sigint.
+static volatile int running = 1;
+
+// Handler for ctrl-c, tells the accept loop to stop.
+void ctrlCHandler( int sig ) {
+  running = 0;
+}
+
+// Read a sequence file the way maxpalindrome-sem reads its input, one character per line.
+// The buffer starts with room for size characters, and its capacity is stored in bytes.
+// Returns the characters, or NULL if the file can't be read.
+char *readSequence( char const *path, bool normalize, long size, int *len, long *bytes ) {
+  FILE *fp = fopen( path, "r" );
+  if ( !fp )
+    return NULL;
+
+  // Read the whole file. It only has to grow if the file got longer since it was checked.
+  int cap = size + 1;
+  int count = 0;
+  char *raw = ( char * ) malloc( cap + NORMALIZE_SLACK );
+  size_t got;
+  while ( ( got = fread( raw + count, 1, cap - count, fp ) ) > 0 ) {
+    count += got;
+    if ( count == cap ) {
+      cap *= 2;
+      raw = ( char * ) realloc( raw, cap + NORMALIZE_SLACK );
+    }
+  }
+  fclose( fp );
+  *bytes = cap + NORMALIZE_SLACK;
+
+  // Normalize in place, or keep the first character of each run that "%c\n" would read.
+  if ( normalize ) {
+    Normalizer norm;
+    initNormalizer( &norm );
+    *len = normalizeBlock( &norm, ( unsigned char * ) raw, count, raw );
+  }
+  else {
+    *len = 0;
+    for ( int i = 0; i < count; i++ ) {
+      raw[ ( *len )++ ] = raw[ i ];
+      while ( i + 1 < count && isspace( raw[ i + 1 ] ) )
+        i++;
+    }
+  }
+
+  return raw;
+}
+
+// Most bytes loading a file of the given size can use while its index is built.
+long loadEstimate( long size ) {
+  long n = 2 * size + 2;
+  int levels = 1;
+  while ( ( 1L << levels ) <= n )
+    levels++;
+
+  // The text, suffix array, rank and LCP, the sparse table levels above the LCP, and about one more
+  // array of ints and two of flags as scratch space for sorting the suffixes.
+  long index = ( 4 + levels ) * n * sizeof( int ) + 2 * n;
+
+  // The buffer the file is read into and the lengths that are kept.
+  return size + 1 + NORMALIZE_SLACK + ( 2 * size + 1 ) * sizeof( int ) + index;
+}
+
+// Load and index a file of the given size into a slot being loaded. Returns false if the file can't be read.
+bool buildSequence( Sequence *entry, char const *path, bool normalize, long size ) {
+  long rawBytes;
+  entry->seq = readSequence( path, normalize, size, &entry->len, &rawBytes );
+  if ( !entry->seq )
+    return false;
+
+  // The suffix array gives the palindrome at each center. Only those lengths are kept.
+  int centers = entry->len > 0 ? 2 * entry->len - 1 : 0;
+  entry->lengths = ( int * ) malloc( ( centers + 1 ) * sizeof( int ) );
+  SuffixIndex index;
+  buildSuffixIndex( &index, entry->seq, entry->len, global_workers, NULL, 0 );
+  entry->maxCenter = 0;
+  entry->lengths[ 0 ] = 0;
+  for ( int center = 0; center < centers; center++ ) {
+    int start;
+    entry->lengths[ center ] = palindromeAt( &index, center, &start );
+    if ( entry->lengths[ center ] > entry->lengths[ entry->maxCenter ] )
+      entry->maxCenter = center;
+  }
+  freeSuffixIndex( &index );
+
+  entry->normalized = normalize;
+  entry->bytes = rawBytes + ( long ) ( centers + 1 ) * sizeof( int );
+  return true;
+}
+
+// Free the memory used by a sequence and mark its slot free.
+void freeSequence( Sequence *entry ) {
+  free( entry->seq );
+  free( entry->lengths );
+  entry->path[ 0 ] = '\0';
+}
+
+// Find a loaded sequence. Must be called with the table semaphore held.
+Sequence *findSequence( char const *path ) {
+  for ( int i = 0; i < MAX_SEQUENCES; i++ )
+    if ( sequences[ i ].path[ 0 ] && strcmp( sequences[ i ].path, path ) == 0 )
+      return &sequences[ i ];
+
+  return NULL;
+}
+
+// Evict least recently used sequences until the given number of bytes fits in the budget.
+// Must be called with the table semaphore held. Returns a free slot, or NULL if there isn't room.
+Sequence *makeRoom( long bytes ) {
+  while ( true ) {
+    Sequence *freeSlot = NULL;
+    Sequence *oldest = NULL;
+    for ( int i = 0; i < MAX_SEQUENCES; i++ ) {
+      Sequence *entry = &sequences[ i ];
+      if ( !entry->path[ 0 ] ) {
+        if ( !freeSlot )
+          freeSlot = entry;
+      }
+      else if ( entry->users == 0 && ( !oldest || entry->lastUsed < oldest->lastUsed ) ) {
+        oldest = entry;
+      }
+    }
+
+    if ( freeSlot && memoryUsed + bytes <= memoryBudget )
+      return freeSlot;
+
+    // Evict the least recently used sequence that isn't in use, if there is one.
+    if ( !oldest )
+      return NULL;
+    memoryUsed -= oldest->bytes;
+    freeSequence( oldest );
+  }
+}
+
+// Get the sequence for a path, loading it if needed, and mark it in use.
+// Returns NULL and sets message if it can't be loaded.
+Sequence *acquireSequence( char const *path, bool normalize, char const **message ) {
+  sem_wait( &table_sem );
+
+  // If another worker is loading the path, wait for it and look again.
+  Sequence *entry;
+  while ( ( entry = findSequence( path ) ) && entry->loading ) {
+    entry->waiting++;
+    sem_post( &table_sem );
+    sem_wait( &entry->ready_sem );
+    sem_wait( &table_sem );
+  }
+
+  if ( entry ) {
+    entry->users++;
+    entry->lastUsed = ++useClock;
+    sem_post( &table_sem );
+    return entry;
+  }
+
+  // Make room for the index from the size of the file, before building it.
+  struct stat info;
+  if ( stat( path, &info ) != 0 || !S_ISREG( info.st_mode ) ) {
+    sem_post( &table_sem );
+    *message = "cannot read sequence";
+    return NULL;
+  }
+
+  long reserved = loadEstimate( info.st_size );
+  if ( info.st_size > MAX_FILE_SIZE || reserved > memoryBudget || !( entry = makeRoom( reserved ) ) ) {
+    sem_post( &table_sem );
+    *message = "sequence does not fit in the memory budget";
+    return NULL;
+  }
+
+  // List the slot as loading, so it isn't evicted and other requests for the path wait for it.
+  strcpy( entry->path, path );
+  entry->loading = true;
+  entry->users = 1;
+  entry->lastUsed = ++useClock;
+  entry->bytes = reserved;
+  memoryUsed += reserved;
+  sem_post( &table_sem );
+
+  // Build the index without holding the table, so other queries keep running.
+  bool built = buildSequence( entry, path, normalize, info.st_size );
+
+  sem_wait( &table_sem );
+  memoryUsed -= reserved;
+  entry->loading = false;
+  if ( built ) {
+    memoryUsed += entry->bytes;
+  }
+  else {
+    entry->path[ 0 ] = '\0';
+    entry->users = 0;
+  }
+
+  // Wake the requests that were waiting on this load.
+  for ( ; entry->waiting > 0; entry->waiting-- )
+    sem_post( &entry->ready_sem );
+  sem_post( &table_sem );
+
+  if ( !built ) {
+    *message = "cannot read sequence";
+    return NULL;
+  }
+  return entry;
+}
+
+// Mark a sequence as no longer in use by a query.
+void releaseSequence( Sequence *entry ) {
+  sem_wait( &table_sem );
+  entry->users--;
+  sem_post( &table_sem );
+}
+
+// Length of the palindrome at a center, trimmed to fit in [ a, b ). The start is stored in start.
+int trimmedLength( Sequence const *entry, int center, int a, int b, int *start ) {
+  int i = center / 2;
+  int length = entry->lengths[ center ];
+
+  // Odd palindromes have radius ( length - 1 ) / 2 around i, even ones radius length / 2 around the gap.
+  int left = center % 2 == 0 ? i - ( length - 1 ) / 2 : i + 1 - length / 2;
+  int right = left + length;
+  int trim = 0;
+  if ( a - left > trim )
+    trim = a - left;
+  if ( right - b > trim )
+    trim = right - b;
+
+  *start = left + trim;
+  return length - 2 * trim;
+}
+
+// Answer a range query, the longest palindrome entirely inside [ a, b ).
+void rangeQuery( Sequence const *entry, int a, int b, char *reply ) {
+  int best = 0;
+  int bestStart = a;
+  for ( int center = 2 * a; center < 2 * b - 1; center++ ) {
+    int start;
+    int length = trimmedLength( entry, center, a, b, &start );
+    if ( length > best ) {
+      best = length;
+      bestStart = start;
+    }
+  }
+
+  sprintf( reply, "%d %d\n", best, bestStart );
+}
+
+// Answer a top query, the k longest palindromes at distinct centers.
+void topQuery( Sequence const *entry, int k, char *reply ) {
+  // Keep the best centers found so far, longest first.
+  int top[ MAX_TOP ];
+  int count = 0;
+  int centers = entry->len > 0 ? 2 * entry->len - 1 : 0;
+  for ( int center = 0; center < centers; center++ ) {
+    int length = entry->lengths[ center ];
+    if ( count == k && length <= entry->lengths[ top[ count - 1 ] ] )
+      continue;
+
+    // Insert the center in order, dropping the shortest if the list is full.
+    int pos = count < k ? count++ : k - 1;
+    while ( pos > 0 && entry->lengths[ top[ pos - 1 ] ] < length ) {
+      top[ pos ] = top[ pos - 1 ];
+      pos--;
+    }
+    top[ pos ] = center;
+  }
+
+  // Reply with a length and start for each one.
+  int len = 0;
+  for ( int i = 0; i < count; i++ ) {
+    int start;
+    int length = trimmedLength( entry, top[ i ], 0, entry->len, &start );
+    len += sprintf( reply + len, i ? " %d %d" : "%d %d", length, start );
+  }
+  sprintf( reply + len, "\n" );
+}
+
+// Run one command from a client and store the reply in reply.
+void runCommand( char *line, char *reply ) {
+  char command[ 16 ] = "";
+  char path[ LINE_LIMIT ] = "";
+  char option[ 16 ] = "";
+  int a = 0;
+  int b = 0;
+  int fields = sscanf( line, "%15s %4095s %d %d", command, path, &a, &b );
+
+  // Load and stats don't need a query on a sequence.
+  if ( strcmp( command, "stats" ) == 0 ) {
+    sem_wait( &table_sem );
+    int loaded = 0;
+    for ( int i = 0; i < MAX_SEQUENCES; i++ )
+      if ( sequences[ i ].path[ 0 ] && !sequences[ i ].loading )
+        loaded++;
+    sprintf( reply, "sequences %d bytes %ld budget %ld\n", loaded, memoryUsed, memoryBudget );
+    sem_post( &table_sem );
+    return;
+  }
+
+  if ( fields < 2 ) {
+    sprintf( reply, "error\n" );
+    return;
+  }
+
+  if ( strcmp( command, "unload" ) == 0 ) {
+    sem_wait( &table_sem );
+    Sequence *entry = findSequence( path );
+    if ( entry && entry->users == 0 ) {
+      memoryUsed -= entry->bytes;
+      freeSequence( entry );
+      sprintf( reply, "ok\n" );
+    }
+    else {
+      sprintf( reply, "error\n" );
+    }
+    sem_post( &table_sem );
+    return;
+  }
+
+  // Load takes an optional normalize option after the path.
+  bool normalize = false;
+  if ( strcmp( command, "load" ) == 0 && sscanf( line, "%*s %*s %15s", option ) == 1 ) {
+    if ( strcmp( option, "normalize" ) != 0 ) {
+      sprintf( reply, "error\n" );
+      return;
+    }
+    normalize = true;
+  }
+
+  char const *message = "";
+  Sequence *entry = acquireSequence( path, normalize, &message );
+  if ( !entry ) {
+    sprintf( reply, "error %s\n", message );
+    return;
+  }
+
+  if ( strcmp( command, "load" ) == 0 && entry->normalized != normalize ) {
+    sprintf( reply, "error already loaded with different options\n" );
+  }
+  else if ( strcmp( command, "load" ) == 0 ) {
+    sprintf( reply, "ok %d\n", entry->len );
+  }
+  else if ( strcmp( command, "max" ) == 0 && fields == 2 ) {
+    // The longest palindrome was found when the sequence was loaded.
+    int start;
+    int length = trimmedLength( entry, entry->maxCenter, 0, entry->len, &start );
+    sprintf( reply, "%d %d\n", length, start );
+  }
+  else if ( strcmp( command, "top" ) == 0 && fields == 3 && a > 0 && a <= MAX_TOP ) {
+    topQuery( entry, a, reply );
+  }
+  else if ( strcmp( command, "range" ) == 0 && fields == 4 && a >= 0 && a < b && b <= entry->len ) {
+    rangeQuery( entry, a, b, reply );
+  }
+  else {
+    sprintf( reply, "error\n" );
+  }
+
+  releaseSequence( entry );
+}
+
+// Serve commands from one client until it disconnects.
+void serveClient( int fd ) {
+  // Bytes received that haven't been handled yet.
+  static __thread char input[ LINE_LIMIT * 2 ];
+  int inputLen = 0;
+
+  // Replies waiting to be sent.
+  static __thread char output[ LINE_LIMIT * 4 ];
+  int outputLen = 0;
+
+  char reply[ MAX_TOP * 24 + 64 ];
+  int got;
+  while ( ( got = read( fd, input + inputLen, sizeof( input ) - inputLen - 1 ) ) > 0 ) {
+    inputLen += got;
+    input[ inputLen ] = '\0';
+
+    // Run every complete command that has arrived, collecting the replies.
+    char *line = input;
+    char *newline;
+    while ( ( newline = strchr( line, '\n' ) ) ) {
+      *newline = '\0';
+      runCommand( line, reply );
+      line = newline + 1;
+
+      // Send the collected replies early if the next one might not fit.
+      int replyLen = strlen( reply );
+      if ( outputLen + replyLen > ( int ) sizeof( output ) ) {
+        if ( write( fd, output, outputLen ) != outputLen ) {
+          close( fd );
+          return;
+        }
+        outputLen = 0;
+      }
+      memcpy( output + outputLen, reply, replyLen );
+      outputLen += replyLen;
+    }
+
+    // Pipelined commands that arrived together get their replies in a single write.
+    if ( outputLen > 0 && write( fd, output, outputLen ) != outputLen ) {
+      close( fd );
+      return;
+    }
+    outputLen = 0;
+
+    // Keep any partial command for the next read, dropping lines that are too long.
+    inputLen -= line - input;
+    memmove( input, line, inputLen );
+    if ( inputLen >= ( int ) sizeof( input ) - 1 )
+      inputLen = 0;
+  }
+
+  close( fd );
+}
+
+// Start routine for each worker. Takes connections off the queue and serves them.
+void *workerRoutine( void *arg ) {
+  while ( true ) {
+    // Wait for a connection, then take it off the queue.
+    sem_wait( &conn_sem );
+    sem_wait( &queue_sem );
+    int fd = connQueue[ queueHead ];
+    queueHead = ( queueHead + 1 ) % QUEUE_SIZE;
+    sem_post( &queue_sem );
+    sem_post( &slot_sem );
+
+    serveClient( fd );
+  }
+
+  return NULL;
+}
+
+int main( int argc, char *argv[] ) {
+  // Number of workers the user selects.
+  int workers = 4;
+
+  // Budget in megabytes.
+  long budget = 0;
+
+  // Parse command-line arguments.
+  if ( argc != 4 || sscanf( argv[ 2 ], "%d", &workers ) != 1 || workers < 1 ||
+       sscanf( argv[ 3 ], "%ld", &budget ) != 1 || budget < 1 )
+    usage();
+
+  global_workers = workers;
+  memoryBudget = budget * 1024 * 1024;
+
+  sem_init( &table_sem, 0, 1 );
+  for ( int i = 0; i < MAX_SEQUENCES; i++ )
+    sem_init( &sequences[ i ].ready_sem, 0, 0 );
+  sem_init( &conn_sem, 0, 0 );
+  sem_init( &slot_sem, 0, QUEUE_SIZE );
+  sem_init( &queue_sem, 0, 1 );
+
+  // Make the listening socket, replacing any left over from a previous run.
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  if ( strlen( argv[ 1 ] ) >= sizeof( addr.sun_path ) )
+    fail( "Socket path is too long" );
+  strcpy( addr.sun_path, argv[ 1 ] );
+  unlink( argv[ 1 ] );
+
+  int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( listener == -1 || bind( listener, ( struct sockaddr * ) &addr, sizeof( addr ) ) != 0 ||
+       listen( listener, QUEUE_SIZE ) != 0 )
+    fail( "Cannot create the server socket" );
+
+  // Stop cleanly on ctrl-c. The handler is not restarted, so accept returns with EINTR.
+  struct sigaction act;
+  act.sa_handler = ctrlCHandler;
+  sigemptyset( &( act.sa_mask ) );
+  act.sa_flags = 0;
+  sigaction( SIGINT, &act, 0 );
+  sigaction( SIGTERM, &act, 0 );
+
+  // Clients that disconnect early shouldn't kill the server.
+  signal( SIGPIPE, SIG_IGN );
+
+  // Make each of the workers, with ctrl-c blocked so only this thread is ever interrupted by it.
+  // The workers inherit the mask, so their semaphore waits can't return early with EINTR.
+  sigset_t stopSignals, oldMask;
+  sigemptyset( &stopSignals );
+  sigaddset( &stopSignals, SIGINT );
+  sigaddset( &stopSignals, SIGTERM );
+  pthread_sigmask( SIG_BLOCK, &stopSignals, &oldMask );
+
+  pthread_t worker[ workers ];
+  for ( int i = 0; i < workers; i++ )
+    if ( pthread_create( &(worker[ i ]), NULL, workerRoutine, NULL ) != 0 )
+      fail( "Cannot create worker thread" );
+
+  pthread_sigmask( SIG_SETMASK, &oldMask, NULL );
+
+  // Accept connections and hand them to the workers.
+  while ( running ) {
+    int fd = accept( listener, NULL, NULL );
+    if ( fd == -1 ) {
+      if ( errno == EINTR )
+        continue;
+      fail( "Cannot accept a connection" );
+    }
+
+    // Wait for a free slot. A signal can interrupt the waits here, so they are retried.
+    while ( sem_wait( &slot_sem ) != 0 && errno == EINTR )
+      ;
+    while ( sem_wait( &queue_sem ) != 0 && errno == EINTR )
+      ;
+    connQueue[ queueTail ] = fd;
+    queueTail = ( queueTail + 1 ) % QUEUE_SIZE;
+    sem_post( &queue_sem );
+    sem_post( &conn_sem );
+  }
+
+  // Remove the socket so the next run can bind it.
+  close( listener );
+  unlink( argv[ 1 ] );
+
+  return EXIT_SUCCESS;
+}
@@ -2,9 +2,26 @@
     @file peg.c
     @author Ian M Brain (imbrain)
     This program allows users to perform moves on the game board.
-    Provides functionality to perform moves, undo moves, and show the state of the board.
-    Utilizes names semaphores to provide mutual exclusion when performing moves on the board.
-    Interacts with reset.c through shared memory.
+    Provides functionality to perform moves, undo and redo moves, and show the state of the board.
+    Every move since the last reset is kept in the journal, so moves can be undone all the way
+    back to the start, and the history of the game can be printed or replayed.
+    Utilizes a robust mutex in the shared memory to provide mutual exclusion when performing moves
+    on the board, so a peg that dies holding it can't lock everyone else out. Built with -DSEMAPHORE,
+    the named semaphore is used instead.
+    Readers never take the lock: they copy the game state under a seqlock and retry if a
+    change was written while they were copying it.
+    Built with -DLOCKFREE -mcx16, each change is instead committed with one compare-and-swap of
+    the 16-byte game state, retried if another process changed the game first.
+    Interacts with reset.c through shared memory. The game played is the one in the session given
+    as the first argument, or in session zero if there isn't one.
+    The batch command makes a whole list of moves under one lock, or none of them if any is
+    illegal, reporting which one it was.
+    The bench command forks processes that each run a mix of moves, undos and shows, and prints
+    their throughput and latency percentiles as CSV, to compare the builds' locking.
+    The moves command lists every legal move on the board, and the hint command gives one that
+    keeps the board solvable, found with the endgame database.
+    The shell command maps the game once and then runs commands read from a script file or
+    standard input, one per line, so players making many moves don't start a process for each.
 */
 
 #include <stdlib.h>
@@ -14,14 +31,68 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/types.h>
-#include <sys/shm.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <errno.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "common.h"
+#include "bitboard.h"
+#include "endgame.h"
+#include "journal.h"
+#include "transport.h"
 #include <semaphore.h>
 
+#ifdef SEMAPHORE
 /** Sempahore to provide mutual exclusion for different commands. */
 sem_t *sem_lock;
+#endif
+
+/** Journal of the moves made since the last reset. */
+Journal journal;
+
+/** Where command errors are printed, or NULL for standard error. */
+FILE *errorStream;
+
+// Name of the locking backend this peg was built with, for the benchmark's results.
+#if defined( LOCKFREE )
+  #define BACKEND "cas"
+#elif defined( UNSAFE )
+  #define BACKEND "unsafe"
+#elif defined( SEMAPHORE )
+  #define BACKEND "semaphore"
+#else
+  #define BACKEND "mutex"
+#endif
+
+// Latency percentiles the benchmark reports, in tenths of a percent.
+static int const benchPercentiles[] = { 500, 900, 990, 999 };
+
+// Most words on a shell command line, the longest command and its arguments.
+#define SHELL_ARGS 5
+
+// A change to make to the game state, and what it has taken from the journal so far.
+struct Change {
+  /** Game the change is made to. */
+  Puzzle *state;
+
+  /** Row, column and direction of the move to make. */
+  int r, c, dir;
+
+  /** Journal node written for this change, kept if the commit has to be tried again. */
+  uint32_t node;
+
+  /** Moves of a batch, packed with MOVE_CODE(), and how many there are. */
+  unsigned char const *codes;
+  int count;
+
+  /** Journal node written for each move of a batch, kept like node. */
+  uint32_t *nodes;
+
+  /** Index of the batch move that was illegal, or -1 if the batch failed for another reason. */
+  int failed;
+} typedef Change;
 
 // Print out an error message and exit.
 static void fail( char const *message ) {
@@ -29,425 +100,820 @@ static void fail( char const *message ) {
   exit( 1 );
 }
 
-// Make a move in the given direction from the given
-// row, column location (r, c). The dir value is one of
-// the four constants, RIGHT_DIR, DOWN_DIR, LEFT_DIR or UP_DIR
-// from common.h
-bool move( Puzzle *state, int r, int c, int dir )
+// Set when a change fails because the journal has no room for its nodes, so the error says so.
+static bool journalFull = false;
+
+// Print the error message for a command that failed, and return its status.
+static int commandError() {
+  fprintf( errorStream ? errorStream : stderr, journalFull ? "error: move journal is full\n" : "error\n" );
+  journalFull = false;
+  return EXIT_FAILURE;
+}
+
+// Put the game back together after a process died holding the lock. If it died while writing the
+// game state, the pegs are rebuilt from the last move node, and the redo stack, which might not go
+// with that node, is dropped.
+void recover( Puzzle *state )
 {
-  // Acquire the shared semaphore to prevent other commands from running.
-  #ifndef UNSAFE
+  if ( state->sequence & 1 ) {
+    uint64_t pegs = state->start.pegs;
+    for ( uint32_t index = state->game.node; index; ) {
+      JournalNode const *node = journalNode( &journal, index );
+      if ( !node )
+        fail( "Cannot read the move journal" );
+      pegs ^= moveCells( MOVE_ROW( node->value ), MOVE_COL( node->value ), MOVE_DIR( node->value ) );
+      index = node->link;
+    }
+
+    __atomic_store_n( &state->game.pegs, pegs, __ATOMIC_RELAXED );
+    __atomic_store_n( &state->game.redo, 0, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &state->sequence, 1, __ATOMIC_RELEASE );
+  }
+
+  pthread_mutex_consistent( &state->lock );
+}
+
+// Acquire the lock to prevent other commands from running.
+void lockPuzzle( Puzzle *state )
+{
+  #ifdef SEMAPHORE
     sem_wait( sem_lock );
+  #else
+    if ( pthread_mutex_lock( &state->lock ) == EOWNERDEAD )
+      recover( state );
   #endif
+}
 
-  // If the command direction is right, perform a right move.
-  if( dir == RIGHT_DIR ) {
-    // A right command is invalid if the column is more than five or less than zero.
-    if ( c > 5 || c < 0 ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+// Release the lock so that other operations can be performed.
+void unlockPuzzle( Puzzle *state )
+{
+  #ifdef SEMAPHORE
+    sem_post( sem_lock );
+  #else
+    pthread_mutex_unlock( &state->lock );
+  #endif
+}
 
-      return false;
+// Take a consistent copy of the game state.
+GameState snapshot( Puzzle *state )
+{
+  #ifdef LOCKFREE
+    // A compare-and-swap that never matches is the only 16-byte atomic read there is. Wait out
+    // a reset or end that is replacing the game.
+    GameWord current;
+    current.word = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game, 0, 0 );
+    while ( current.game.node == CLOSED_NODE ) {
+      sched_yield();
+      current.word = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game, 0, 0 );
     }
-    // A right command is invalid if the index to the right is not a peg or the index after that is not empty
-    else if ( state->puzzleBoard[ r ][ c ] != 'o' || state->puzzleBoard[ r ][ c + 1 ] != 'o' || state->puzzleBoard[ r ][ c + 2 ] != '.' ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+    return current.game;
+  #else
+    // Copy the state between two reads of the sequence, and start over if a writer was busy
+    // or finished in between. Writers never wait for readers.
+    while ( true ) {
+      uint32_t before = __atomic_load_n( &state->sequence, __ATOMIC_ACQUIRE );
+      if ( before & 1 ) {
+        // Wait for the writer on the lock, which also puts the game back together if it died.
+        #ifndef UNSAFE
+          lockPuzzle( state );
+          unlockPuzzle( state );
+        #else
+          sched_yield();
+        #endif
+        continue;
+      }
 
-      return false;
+      GameState game;
+      game.pegs = __atomic_load_n( &state->game.pegs, __ATOMIC_RELAXED );
+      game.node = __atomic_load_n( &state->game.node, __ATOMIC_RELAXED );
+      game.redo = __atomic_load_n( &state->game.redo, __ATOMIC_RELAXED );
+
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      if ( __atomic_load_n( &state->sequence, __ATOMIC_RELAXED ) == before )
+        return game;
     }
-    // Otherwise, perform the valid move and udpate the undo history with the successful move.
-    else {
-      // Perform the move.
-      state->puzzleBoard[ r ][ c ] = '.';
-      state->puzzleBoard[ r ][ c + 1 ] = '.';
-      state->puzzleBoard[ r ][ c + 2 ] = 'o';
-
-      // Convert the integer row into a string.
-      char row_str[ 2 ] = "";
-      sprintf(row_str, "%d", r);
-
-      // Convert the integer column into a string.
-      char col_str[ 2 ] = "";
-      sprintf(col_str, "%d", c);
-
-      // Convert the integer direction into a string.
-      char dir_str[ 2 ] = "";
-      sprintf(dir_str, "%d", dir);
-
-      // Copy each of the strings into a full command to be added to the undo history.
-      char full_command[ 3 + 1 ] = "";
-      strcpy( full_command, row_str );
-      strcat( full_command, col_str );
-      strcat( full_command, dir_str );
-
-      // Update the undo history to include the most recent move.
-      strcpy( state->undoHistory[ 2 ], state->undoHistory[ 1 ] );
-      strcpy( state->undoHistory[ 1 ], state->undoHistory[ 0 ] );
-      strcpy( state->undoHistory[ 0 ], full_command );
-
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
-
-      return true;
-    }
-  }
-  // If the command direction is left, perform a left move.
-  else if( dir == LEFT_DIR ) {
-    // A left command is invalid if the column is more than five or less than zero.
-    if ( c > 7 || c < 2 ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+  #endif
+}
 
-      return false;
+// Take a consistent copy of the board, and of the pegs the game started with if start isn't NULL.
+// A reset changes the cells of the board along with the game, so start over if the generation
+// changes in between.
+Bitboard snapshotBoard( Puzzle *state, uint64_t *start )
+{
+  while ( true ) {
+    uint32_t generation = __atomic_load_n( &state->generation, __ATOMIC_ACQUIRE );
+    uint64_t valid = __atomic_load_n( &state->valid, __ATOMIC_RELAXED );
+    if ( start )
+      *start = __atomic_load_n( &state->start.pegs, __ATOMIC_RELAXED );
+    GameState game = snapshot( state );
+
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if ( __atomic_load_n( &state->generation, __ATOMIC_RELAXED ) == generation )
+      return boardFromPegs( valid, game.pegs );
+  }
+}
+
+#ifdef LOCKFREE
+// Slot this peg has in the game's list of pegs changing it.
+static int changingSlot;
+
+// Take this peg off the list of pegs changing the game.
+static void leaveGame( Puzzle *state )
+{
+  __atomic_store_n( &state->changing[ changingSlot ], 0, __ATOMIC_RELEASE );
+}
+
+// Put this peg on the list of pegs changing the game, and copy the game once no reset or end is
+// replacing it. A reset waits for the pegs on the list to give up before it reuses the nodes.
+static GameWord enterGame( Puzzle *state )
+{
+  // Try the slots in turn from one picked by the process ID, so pegs rarely want the same one.
+  // Give up the processor after every pass that finds them all taken.
+  pid_t pid = getpid();
+  for ( unsigned int tried = 1; ; tried++ ) {
+    changingSlot = ( ( unsigned int ) pid + tried ) % CHANGERS;
+    pid_t expected = 0;
+    if ( !__atomic_compare_exchange_n( &state->changing[ changingSlot ], &expected, pid, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) ) {
+      // Free the slot of a peg that died part way through a change.
+      if ( kill( expected, 0 ) != 0 && errno == ESRCH )
+        __atomic_compare_exchange_n( &state->changing[ changingSlot ], &expected, 0, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED );
+      if ( tried % CHANGERS == 0 )
+        sched_yield();
+      continue;
     }
-    // A left command is invalid if the index to the left is not a peg or the index after that is not empty
-    else if ( state->puzzleBoard[ r ][ c ] != 'o' || state->puzzleBoard[ r ][ c - 1 ] != 'o' || state->puzzleBoard[ r ][ c - 2 ] != '.' ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
 
+    GameWord current;
+    current.word = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game, 0, 0 );
+    if ( current.game.node != CLOSED_NODE )
+      return current;
+
+    leaveGame( state );
+    sched_yield();
+  }
+}
+#endif
+
+// Get the journal node for a change, allocating it the first time. Returns NULL if the journal is full.
+static JournalNode *changeNode( Change *change )
+{
+  if ( !change->node )
+    change->node = journalAlloc( &journal, &change->state->arena );
+
+  JournalNode *node = change->node ? journalNode( &journal, change->node ) : NULL;
+  journalFull = !node;
+  return node;
+}
+
+// Compute the game state after making the move in change from the given one.
+static bool stepMove( GameState const *current, GameState *next, Change *change )
+{
+  // Check the move against the bitboard and perform it if it is legal. The board's cells are read
+  // here, where no reset can replace the game, and again each time the change is tried.
+  Bitboard board = boardFromPegs( __atomic_load_n( &change->state->valid, __ATOMIC_RELAXED ), current->pegs );
+  if ( !bitboardMove( &board, change->r, change->c, change->dir ) )
+    return false;
+
+  // Add a node for the move on top of the last one. Making a move forgets the undone moves.
+  JournalNode *node = changeNode( change );
+  if ( !node )
+    return false;
+  node->link = current->node;
+  node->value = MOVE_CODE( change->r, change->c, change->dir );
+
+  next->pegs = board.pegs;
+  next->node = change->node;
+  next->redo = 0;
+  return true;
+}
+
+// Compute the game state after undoing the last move of the given one.
+static bool stepUndo( GameState const *current, GameState *next, Change *change )
+{
+  // Send error if there are no moves left to undo.
+  JournalNode const *last = current->node ? journalNode( &journal, current->node ) : NULL;
+  if ( !last )
+    return false;
+  uint32_t parent = last->link;
+  unsigned char code = last->value;
+
+  // Push the undone move onto the redo stack. A stack of just that move needs no node.
+  next->redo = current->node | REDO_MOVE;
+  if ( current->redo ) {
+    JournalNode *node = changeNode( change );
+    if ( !node )
       return false;
-    }
-    // Otherwise, perform the valid move and udpate the undo history with the successful move.
-    else {
-      // Perform the move.
-      state->puzzleBoard[ r ][ c ] = '.';
-      state->puzzleBoard[ r ][ c - 1 ] = '.';
-      state->puzzleBoard[ r ][ c - 2 ] = 'o';
-
-      // Convert the integer row into a string.
-      char row_str[ 2 ] = "";
-      sprintf(row_str, "%d", r);
-
-      // Convert the integer column into a string.
-      char col_str[ 2 ] = "";
-      sprintf(col_str, "%d", c);
-
-      // Convert the integer direction into a string.
-      char dir_str[ 2 ] = "";
-      sprintf(dir_str, "%d", dir);
-
-      // Copy each of the strings into a full command to be added to the undo history.
-      char full_command[ 3 + 1 ] = "";
-      strcpy( full_command, row_str );
-      strcat( full_command, col_str );
-      strcat( full_command, dir_str );
-
-      // Update the undo history to include the most recent move.
-      strcpy( state->undoHistory[ 2 ], state->undoHistory[ 1 ] );
-      strcpy( state->undoHistory[ 1 ], state->undoHistory[ 0 ] );
-      strcpy( state->undoHistory[ 0 ], full_command );
-
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
-
-      return true;
-    }
-  }
-  // If the command direction is up, perform a up move.
-  else if( dir == UP_DIR ) {
-    // A up command is invalid if the column is more than five or less than zero.
-    if ( r < 2 || r > 7 ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+    node->link = current->redo;
+    node->value = current->node;
+    next->redo = change->node;
+  }
+
+  // Flipping the cells of the move again puts the pegs back.
+  next->pegs = current->pegs ^ moveCells( MOVE_ROW( code ), MOVE_COL( code ), MOVE_DIR( code ) );
+  next->node = parent;
+  return true;
+}
 
+// Compute the game state after making the last undone move of the given one again.
+static bool stepRedo( GameState const *current, GameState *next, Change *change )
+{
+  // Send error if there are no undone moves to make again.
+  if ( !current->redo )
+    return false;
+
+  // Pop the top undone move, which is the whole stack if it is only one.
+  uint32_t below = 0;
+  uint32_t moveNode = current->redo & ~REDO_MOVE;
+  if ( !( current->redo & REDO_MOVE ) ) {
+    JournalNode const *top = journalNode( &journal, current->redo );
+    if ( !top )
       return false;
-    }
-    // A up command is invalid if the index to the up is not a peg or the index after that is not empty
-    else if ( state->puzzleBoard[ r ][ c ] != 'o' || state->puzzleBoard[ r - 1 ][ c ] != 'o' || state->puzzleBoard[ r - 2 ][ c ] != '.' ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+    below = top->link;
+    moveNode = top->value;
+  }
+
+  JournalNode const *undone = journalNode( &journal, moveNode );
+  if ( !undone )
+    return false;
+  unsigned char code = undone->value;
+
+  // The move was legal when it was undone, and the board is back to how it was then.
+  next->pegs = current->pegs ^ moveCells( MOVE_ROW( code ), MOVE_COL( code ), MOVE_DIR( code ) );
+  next->node = moveNode;
+  next->redo = below;
+  return true;
+}
 
+// Compute the game state after making every move of the batch in change from the given one.
+static bool stepBatch( GameState const *current, GameState *next, Change *change )
+{
+  Bitboard board = boardFromPegs( __atomic_load_n( &change->state->valid, __ATOMIC_RELAXED ), current->pegs );
+  uint32_t last = current->node;
+  for ( int i = 0; i < change->count; i++ ) {
+    // Check each move against the board left by the ones before it. Nothing has been
+    // committed yet, so stopping here leaves the game as it was.
+    unsigned char code = change->codes[ i ];
+    if ( !bitboardMove( &board, MOVE_ROW( code ), MOVE_COL( code ), MOVE_DIR( code ) ) ) {
+      change->failed = i;
       return false;
     }
-    // Otherwise, perform the valid move and udpate the undo history with the successful move.
-    else {
-      // Perform the move.
-      state->puzzleBoard[ r ][ c ] = '.';
-      state->puzzleBoard[ r - 1 ][ c ] = '.';
-      state->puzzleBoard[ r - 2 ][ c ] = 'o';
-
-      // Convert the integer row into a string.
-      char row_str[ 2 ] = "";
-      sprintf(row_str, "%d", r);
-
-      // Convert the integer column into a string.
-      char col_str[ 2 ] = "";
-      sprintf(col_str, "%d", c);
-
-      // Convert the integer direction into a string.
-      char dir_str[ 2 ] = "";
-      sprintf(dir_str, "%d", dir);
-
-      // Copy each of the strings into a full command to be added to the undo history.
-      char full_command[ 3 + 1 ] = "";
-      strcpy( full_command, row_str );
-      strcat( full_command, col_str );
-      strcat( full_command, dir_str );
-
-      // Update the undo history to include the most recent move.
-      strcpy( state->undoHistory[ 2 ], state->undoHistory[ 1 ] );
-      strcpy( state->undoHistory[ 1 ], state->undoHistory[ 0 ] );
-      strcpy( state->undoHistory[ 0 ], full_command );
-
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
-
-      return true;
-    }
-  }
-  // If the command direction is down, perform a down move.
-  else if( dir == DOWN_DIR ) {
-    // A down command is invalid if the column is more than five or less than zero.
-    if ( r > 5 || r < 0 ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
 
+    // Chain a node for the move onto the one before it.
+    if ( !change->nodes[ i ] )
+      change->nodes[ i ] = journalAlloc( &journal, &change->state->arena );
+    JournalNode *node = change->nodes[ i ] ? journalNode( &journal, change->nodes[ i ] ) : NULL;
+    if ( !node ) {
+      journalFull = true;
+      change->failed = -1;
       return false;
     }
-    // A down command is invalid if the index to the down is not a peg or the index after that is not empty
-    else if ( state->puzzleBoard[ r ][ c ] != 'o' || state->puzzleBoard[ r + 1 ][ c ] != 'o' || state->puzzleBoard[ r + 2 ][ c ] != '.' ) {
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+    node->link = last;
+    node->value = code;
+    last = change->nodes[ i ];
+  }
 
-      return false;
+  next->pegs = board.pegs;
+  next->node = last;
+  next->redo = 0;
+  return true;
+}
+
+// Apply a change to the shared game state. Returns false, leaving the game as it was,
+// if step says the change can't be made.
+static bool commit( Puzzle *state, bool ( *step )( GameState const *, GameState *, Change * ), Change *change )
+{
+  GameState next;
+
+  #ifdef LOCKFREE
+    // Work out the new state from the current one and swap it in if nobody changed the game
+    // in the meantime, otherwise try again from the state they left.
+    GameWord current = enterGame( state ), desired;
+    bool changed = false;
+    while ( step( &current.game, &next, change ) ) {
+      desired.game = next;
+      unsigned __int128 seen = __sync_val_compare_and_swap( ( unsigned __int128 * ) &state->game,
+                                                            current.word, desired.word );
+      if ( seen == current.word ) {
+        changed = true;
+        break;
+      }
+      current.word = seen;
+
+      // A reset or end is replacing the game, and will reuse its nodes and the ones this change
+      // took, so start over on the new game.
+      if ( current.game.node == CLOSED_NODE ) {
+        leaveGame( state );
+        change->node = 0;
+        if ( change->nodes )
+          memset( change->nodes, 0, change->count * sizeof( uint32_t ) );
+        current = enterGame( state );
+      }
     }
-    // Otherwise, perform the valid move and udpate the undo history with the successful move.
-    else {
-      // Perform the move.
-      state->puzzleBoard[ r ][ c ] = '.';
-      state->puzzleBoard[ r + 1 ][ c ] = '.';
-      state->puzzleBoard[ r + 2 ][ c ] = 'o';
 
-      // Convert the integer row into a string.
-      char row_str[ 2 ] = "";
-      sprintf(row_str, "%d", r);
+    leaveGame( state );
+    return changed;
+  #else
+    // Acquire the shared lock to prevent other commands from running.
+    #ifndef UNSAFE
+      lockPuzzle( state );
+    #endif
 
-      // Convert the integer column into a string.
-      char col_str[ 2 ] = "";
-      sprintf(col_str, "%d", c);
+    // Make the sequence odd while the new state is written, so readers know to copy it again.
+    bool changed = step( &state->game, &next, change );
+    if ( changed ) {
+      __atomic_fetch_add( &state->sequence, 1, __ATOMIC_RELAXED );
+      __atomic_thread_fence( __ATOMIC_RELEASE );
+      __atomic_store_n( &state->game.pegs, next.pegs, __ATOMIC_RELAXED );
+      __atomic_store_n( &state->game.node, next.node, __ATOMIC_RELAXED );
+      __atomic_store_n( &state->game.redo, next.redo, __ATOMIC_RELAXED );
+      __atomic_fetch_add( &state->sequence, 1, __ATOMIC_RELEASE );
+    }
 
-      // Convert the integer direction into a string.
-      char dir_str[ 2 ] = "";
-      sprintf(dir_str, "%d", dir);
+    // Release the lock so that other operations can be performed.
+    #ifndef UNSAFE
+      unlockPuzzle( state );
+    #endif
 
-      // Copy each of the strings into a full command to be added to the undo history.
-      char full_command[ 3 + 1 ] = "";
-      strcpy( full_command, row_str );
-      strcat( full_command, col_str );
-      strcat( full_command, dir_str );
+    return changed;
+  #endif
+}
 
-      // Update the undo history to include the most recent move.
-      strcpy( state->undoHistory[ 2 ], state->undoHistory[ 1 ] );
-      strcpy( state->undoHistory[ 1 ], state->undoHistory[ 0 ] );
-      strcpy( state->undoHistory[ 0 ], full_command );
+// Make a move in the given direction from the given
+// row, column location (r, c). The dir value is one of
+// the four constants, RIGHT_DIR, DOWN_DIR, LEFT_DIR or UP_DIR
+// from common.h
+bool move( Puzzle *state, int r, int c, int dir )
+{
+  Change change = { state, r, c, dir, 0 };
+  return commit( state, stepMove, &change );
+}
+
+// Undo the most recent move.
+bool undo( Puzzle *state )
+{
+  Change change = { state, 0, 0, 0, 0 };
+  return commit( state, stepUndo, &change );
+}
 
-      // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+// Make the most recently undone move again.
+bool redo( Puzzle *state )
+{
+  Change change = { state, 0, 0, 0, 0 };
+  return commit( state, stepRedo, &change );
+}
+
+// Make a list of moves, packed with MOVE_CODE(), all at once. If one of them is illegal,
+// none are made and its index is stored in failed, or -1 if the journal is full.
+bool batch( Puzzle *state, unsigned char const *codes, int count, int *failed )
+{
+  uint32_t *nodes = ( uint32_t * ) calloc( count ? count : 1, sizeof( uint32_t ) );
+  Change change = { state, 0, 0, 0, 0, codes, count, nodes, -1 };
+  bool made = commit( state, stepBatch, &change );
+
+  free( nodes );
+  *failed = change.failed;
+  return made;
+}
 
-      return true;
+// Read a list of moves, one per line in the same syntax as the move commands, from fp.
+// Returns the number of moves, stored in a new array in codes that the caller must free.
+// If a line isn't a move, its index is stored in bad, otherwise bad is set to -1.
+int readMoves( FILE *fp, unsigned char **codes, int *bad )
+{
+  int count = 0, capacity = 64;
+  *codes = ( unsigned char * ) malloc( capacity );
+  *bad = -1;
+
+  char line[ 1024 ];
+  while ( fgets( line, sizeof( line ), fp ) ) {
+    // Skip blank lines, such as one at the end of the file.
+    if ( line[ strspn( line, " \t\r\n" ) ] == '\0' )
+      continue;
+
+    char dirName[ 5 + 1 ];
+    int r, c, dir = UP_DIR + 1;
+    if ( sscanf( line, "%5s %d %d", dirName, &r, &c ) == 3 )
+      for ( dir = RIGHT_DIR; dir <= UP_DIR && strcmp( dirName, dirNames[ dir ] ) != 0; dir++ )
+        ;
+
+    // Remember the first line that isn't a move on the board, but keep counting the moves.
+    if ( dir > UP_DIR || r < 0 || r >= GRID_SIZE || c < 0 || c >= GRID_SIZE ) {
+      if ( *bad < 0 )
+        *bad = count;
+      continue;
     }
+
+    if ( count == capacity ) {
+      capacity *= 2;
+      *codes = ( unsigned char * ) realloc( *codes, capacity );
+    }
+    ( *codes )[ count++ ] = MOVE_CODE( r, c, dir );
   }
-  // Otherwise, return false if the move is invalid.
 
-  else {
-    // Release the semaphore so that other operations can be performed.
-      #ifndef UNSAFE
-        sem_post ( sem_lock );
-      #endif
+  return count;
+}
 
-    return false;
+// Copy the starting board and the moves currently applied to it out of the journal.
+// Returns the number of moves, stored in a new array in moves that the caller must free,
+// or leaves moves NULL if the journal can't be read.
+uint64_t copyHistory( Puzzle *state, Bitboard *start, unsigned char **moves )
+{
+  uint64_t count, capacity = 64;
+  *moves = ( unsigned char * ) malloc( capacity );
+
+  // Nodes don't change while they are in the game, so the moves can be read without the lock.
+  // A reset or end can give them to another game part way, though, so start over if the
+  // generation changes before every node read has been checked against it.
+  bool copied = false;
+  while ( !copied ) {
+    uint32_t generation = __atomic_load_n( &state->generation, __ATOMIC_ACQUIRE );
+    GameState game = snapshot( state );
+    *start = state->start;
+
+    // Copy the moves from the last one back to the start.
+    count = 0;
+    copied = true;
+    for ( uint32_t index = game.node; index && copied; count++ ) {
+      JournalNode const *node = journalNode( &journal, index );
+      if ( !node ) {
+        free( *moves );
+        *moves = NULL;
+        return 0;
+      }
+
+      if ( count == capacity ) {
+        capacity *= 2;
+        *moves = ( unsigned char * ) realloc( *moves, capacity );
+      }
+      ( *moves )[ count ] = node->value;
+      index = node->link;
+
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      copied = __atomic_load_n( &state->generation, __ATOMIC_RELAXED ) == generation;
+    }
+
+    // The starting board has to be from the same game as the moves.
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    copied = copied && __atomic_load_n( &state->generation, __ATOMIC_RELAXED ) == generation;
   }
 
-  // Release the semaphore so that other operations can be performed.
-  #ifndef UNSAFE
-    sem_post ( sem_lock );
-  #endif
+  // Put them in the order they were made.
+  for ( uint64_t i = 0; i < count / 2; i++ ) {
+    unsigned char code = ( *moves )[ i ];
+    ( *moves )[ i ] = ( *moves )[ count - 1 - i ];
+    ( *moves )[ count - 1 - i ] = code;
+  }
 
-  return false;
+  return count;
 }
 
-// Undo the most recent move.
-bool undo( Puzzle *state )
+// Print the moves made since the last reset, one per line in the same syntax as the move commands.
+bool history( Puzzle *state )
 {
-  // Acquire the shared semaphore to prevent other commands from running.
-  #ifndef UNSAFE
-    sem_wait( sem_lock );
-  #endif
+  Bitboard start;
+  unsigned char *moves;
+  uint64_t count = copyHistory( state, &start, &moves );
+  if ( !moves )
+    return false;
 
-  // Send error if no move has been made or the undo history is empty.
-  if ( strlen( state->undoHistory[ 0 ] ) <= 1 ) {
-    // Release the semaphore so that other operations can be performed.
-    #ifndef UNSAFE
-      sem_post ( sem_lock );
-    #endif
+  for ( uint64_t i = 0; i < count; i++ )
+    printf( "%s %d %d\n", dirNames[ MOVE_DIR( moves[ i ] ) ], MOVE_ROW( moves[ i ] ), MOVE_COL( moves[ i ] ) );
 
+  free( moves );
+  return true;
+}
+
+// Print the board at the last reset and after each move since then, separated by blank lines.
+bool replay( Puzzle *state )
+{
+  Bitboard board;
+  unsigned char *moves;
+  uint64_t count = copyHistory( state, &board, &moves );
+  if ( !moves )
     return false;
+
+  char boardMessage[ BOARD_TEXT_SIZE + 1 ];
+  boardToText( &board, boardMessage );
+  printf( "%s", boardMessage );
+  for ( uint64_t i = 0; i < count; i++ ) {
+    toggleMove( &board, MOVE_ROW( moves[ i ] ), MOVE_COL( moves[ i ] ), MOVE_DIR( moves[ i ] ) );
+    boardToText( &board, boardMessage );
+    printf( "\n%s", boardMessage );
   }
-  // Otherwise undo the move and send a success message.
-  else {
-    // Undo a right command.
-    if( state->undoHistory[ 0 ][ 2 ] - '0' == RIGHT_DIR ) {
-      // Row of the peg to undo.
-      int row = state->undoHistory[ 0 ][ 0 ] - '0';
-      // Column of the peg to undo.
-      int column = state->undoHistory[ 0 ][ 1 ] - '0';
-
-      // Perform the opposite of the most recent move in the undo history.
-      state->puzzleBoard[ row ][ column ] = 'o';
-      state->puzzleBoard[ row ][ column + 1 ] = 'o';
-      state->puzzleBoard[ row ][ column + 2 ] = '.';
-    }
-    // Undo a left command.
-    else if( state->undoHistory[ 0 ][ 2 ] - '0' == LEFT_DIR ) {
-      // Row of the peg to undo.
-      int row = state->undoHistory[ 0 ][ 0 ] - '0';
-      // Column of the peg to undo.
-      int column = state->undoHistory[ 0 ][ 1 ] - '0';
-
-      // Perform the opposite of the most recent move in the undo history.
-      state->puzzleBoard[ row ][ column ] = 'o';
-      state->puzzleBoard[ row ][ column - 1 ] = 'o';
-      state->puzzleBoard[ row ][ column - 2 ] = '.';
-    }
-    // Undo an up command.
-    else if( state->undoHistory[ 0 ][ 2 ] - '0' == UP_DIR ) {
-      // Row of the peg to undo.
-      int row = state->undoHistory[ 0 ][ 0 ] - '0';
-      // Column of the peg to undo.
-      int column = state->undoHistory[ 0 ][ 1 ] - '0';
-
-      // Perform the opposite of the most recent move in the undo history.
-      state->puzzleBoard[ row ][ column ] = 'o';
-      state->puzzleBoard[ row - 1 ][ column ] = 'o';
-      state->puzzleBoard[ row - 2 ][ column ] = '.';
-    }
-    // Undo a down command.
-    else if( state->undoHistory[ 0 ][ 2 ] - '0' == DOWN_DIR ) {
-      // Row of the peg to undo.
-      int row = state->undoHistory[ 0 ][ 0 ] - '0';
-      // Column of the peg to undo.
-      int column = state->undoHistory[ 0 ][ 1 ] - '0';
-
-      // Perform the opposite of the most recent move in the undo history.
-      state->puzzleBoard[ row ][ column ] = 'o';
-      state->puzzleBoard[ row + 1 ][ column ] = 'o';
-      state->puzzleBoard[ row + 2 ][ column ] = '.';
-    }
-
-    // Update the undo history to not include the most recent move.
-    strcpy( state->undoHistory[ 0 ], state->undoHistory[ 1 ] );
-    strcpy( state->undoHistory[ 1 ], state->undoHistory[ 2 ] );
-    strcpy( state->undoHistory[ 2 ], "" );
-  }
-  // Release the semaphore so that other operations can be performed.
-  #ifndef UNSAFE
-    sem_post ( sem_lock );
-  #endif
 
+  free( moves );
   return true;
 }
 
 // Print the current state of the puzzle
 void show( Puzzle *state )
 {
-  // Acquire the shared semaphore to prevent other commands from running.
-  #ifndef UNSAFE
-    sem_wait( sem_lock );
-  #endif
-  
   // String that the board message will be contained in.
-  char boardMessage[ 73 ] = "";
+  char boardMessage[ BOARD_TEXT_SIZE + 1 ] = "";
 
-  // Copy the puzzle board into the message
-  strncpy( boardMessage, state->puzzleBoard[ 0 ], 9 );
-  for ( int i = 1; i < GRID_SIZE; i++ ) {
-    strncat( boardMessage, state->puzzleBoard[ i ], 9 );
-  }
-
-  // Ensure null terminator is at the end of the board message.
-  strcat( boardMessage, "\0" );
+  // Convert the bitboard into the text form of the board.
+  Bitboard board = snapshotBoard( state, NULL );
+  boardToText( &board, boardMessage );
 
   // Print out the puzzle board.
   printf( "%s", boardMessage );
+}
+
+// Endgame database, mapped the first time a command needs it and kept until peg exits.
+static Endgame endgame;
+
+// True once the endgame database has been mapped.
+static bool endgameLoaded = false;
+
+// Map the endgame database if it isn't already. Returns false if it can't be opened.
+static bool loadEndgame()
+{
+  if ( !endgameLoaded )
+    endgameLoaded = openEndgame( &endgame, endgamePath() );
+  return endgameLoaded;
+}
 
-  // Detatch from the shared memory.
-  shmdt( state );
+// Look up whether the current board can still be solved in the endgame database.
+// Returns one of the ENDGAME constants, or false if the database can't be opened.
+bool solvable( Puzzle *state, int *answer )
+{
+  if ( !loadEndgame() )
+    return false;
+
+  // Copy the board so the lookup works on one consistent position.
+  uint64_t start;
+  Bitboard board = snapshotBoard( state, &start );
+
+  *answer = endgameSolvable( &endgame, start, board.pegs, board.holes );
+  return true;
+}
 
-  // Release the semaphore so that other operations can be performed.
+// Print every legal move on the current board, one per line in the form of the move commands,
+// or "none" if there aren't any.
+void moves( Puzzle *state )
+{
+  // Copy the board so the moves all come from one consistent position.
+  Bitboard board = snapshotBoard( state, NULL );
+
+  bool any = false;
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+    // Take the cells a move can start from one at a time, lowest first.
+    for ( uint64_t cells = movableCells( &board, dir ); cells; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+      printf( "%s %d %d\n", dirNames[ dir ], cell / GRID_SIZE, cell % GRID_SIZE );
+      any = true;
+    }
+  }
+
+  if ( !any )
+    printf( "none\n" );
+}
+
+// Find a move that leaves the current board solvable, from the endgame database of solved positions.
+// Returns false if the database can't be opened. Otherwise sets answer to ENDGAME_SOLVABLE with the
+// move in code, ENDGAME_UNSOLVABLE if no move does, or ENDGAME_UNKNOWN if the database doesn't cover
+// the board.
+bool hint( Puzzle *state, int *answer, unsigned char *code )
+{
+  if ( !loadEndgame() )
+    return false;
+
+  uint64_t start;
+  Bitboard board = snapshotBoard( state, &start );
+
+  // Try each legal move on the copy of the board until one lands on a solvable position.
+  *answer = ENDGAME_UNSOLVABLE;
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR && *answer != ENDGAME_SOLVABLE; dir++ ) {
+    for ( uint64_t cells = movableCells( &board, dir ); cells && *answer != ENDGAME_SOLVABLE; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+      toggleMove( &board, cell / GRID_SIZE, cell % GRID_SIZE, dir );
+      int result = endgameSolvable( &endgame, start, board.pegs, board.holes );
+      toggleMove( &board, cell / GRID_SIZE, cell % GRID_SIZE, dir );
+
+      if ( result == ENDGAME_SOLVABLE ) {
+        *answer = ENDGAME_SOLVABLE;
+        *code = MOVE_CODE( cell / GRID_SIZE, cell % GRID_SIZE, dir );
+      }
+      else if ( result == ENDGAME_UNKNOWN ) {
+        *answer = ENDGAME_UNKNOWN;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Give the session back to the table, so a reset can allocate it again.
+void end( Puzzle *state )
+{
+  // Acquire the shared lock to prevent other commands from running.
+  #ifndef UNSAFE
+    lockPuzzle( state );
+  #endif
+
+  // Give the game's nodes back to the journal, leaving the pegs where they are with no moves to
+  // undo or redo, for any peg still playing on the session.
+  GameState game = { __atomic_load_n( &state->game.pegs, __ATOMIC_RELAXED ), 0, 0 };
+  __atomic_fetch_add( &state->sequence, 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  replaceGame( &journal, state, game, NULL );
+  __atomic_fetch_add( &state->sequence, 1, __ATOMIC_RELEASE );
+  __atomic_store_n( &state->used, 0, __ATOMIC_RELEASE );
+
+  // Release the lock so that other operations can be performed.
   #ifndef UNSAFE
-    sem_post ( sem_lock );
+    unlockPuzzle( state );
   #endif
 }
 
 // Function used to test concurrent modification of the board state.
 void test( Puzzle *state, int n, int dir, int r, int c )
 {
+  // Stop early if the session is reset or ended, rather than playing on someone else's game.
+  uint32_t generation = __atomic_load_n( &state->generation, __ATOMIC_ACQUIRE );
+
   // Run the move command the specified number of times, undoing the command each time. This is used to test mutual exclusion.
-  for ( int i = 0; i < n; i++ ) {
+  for ( int i = 0; i < n && __atomic_load_n( &state->generation, __ATOMIC_RELAXED ) == generation; i++ ) {
       move( state, r, c, dir );
       undo( state );
     }
 }
 
-int main( int argc, char *argv[] ) {
-  // Eventual exit status for success or failure.
-  int status = EXIT_SUCCESS;
+// Current time in nanoseconds, on a clock every process shares.
+static uint64_t nanoTime()
+{
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
-  /* Citing Help from the course website
-  * The code for opening the semaphore and checking for failure is based on the semPost.c example program from the synchronization section of the course website.
-  */
-  // Create the named Semaphore with an initial value of one.
-  sem_lock = sem_open( LOCK_NAME, 0, 0, 1 );
-  
-  // Fail as error if the semaphore cannot be created.
-  if ( sem_lock == SEM_FAILED )
-    fail( "Cannot create the named semaphore" );
+// Write or read all of a buffer through a pipe. Returns false if it ends early.
+static bool writeAll( int fd, void const *buffer, size_t size )
+{
+  for ( size_t done = 0; done < size; ) {
+    ssize_t len = write( fd, ( char const * ) buffer + done, size - done );
+    if ( len <= 0 )
+      return false;
+    done += len;
+  }
+  return true;
+}
 
-  /* Citing Help from the course website
-  * The code for opening and attaching to the shared memory is based on the shmWriter.c example program from the Processes section of the course website.
-  */
-  // Open the shared memory.
-  int shmid = shmget( ftok( "/mnt/ncsudrive/i/imbrain", 1 ), sizeof( Puzzle ), 0 );
-  if ( shmid == -1 )
-    fail( "Shared memory could not be attached " );
-
-  // Attach to the puzzle memory point to the contained struct.
-  Puzzle *puzzleMemory = ( Puzzle * )shmat( shmid, 0, 0 );
-  // Fail if the memory cannot be pointed to
-  if ( puzzleMemory == ( Puzzle * )-1 )
-    fail( "Cannot map to shared memory" );
+static bool readAll( int fd, void *buffer, size_t size )
+{
+  for ( size_t done = 0; done < size; ) {
+    ssize_t len = read( fd, ( char * ) buffer + done, size - done );
+    if ( len <= 0 )
+      return false;
+    done += len;
+  }
+  return true;
+}
+
+// Make a random legal move on the current board, or undo if there isn't one.
+static void randomMove( Puzzle *state, unsigned int *seed )
+{
+  Bitboard board = snapshotBoard( state, NULL );
+  int first = rand_r( seed ) % 4;
+  for ( int i = 0; i < 4; i++ ) {
+    int dir = ( first + i ) % 4;
+    uint64_t cells = movableCells( &board, dir );
+    if ( cells ) {
+      // Skip a random number of the movable pegs.
+      for ( int skip = rand_r( seed ) % __builtin_popcountll( cells ); skip > 0; skip-- )
+        cells &= cells - 1;
+      int cell = __builtin_ctzll( cells );
+
+      // Another process may get there first, which is part of what is being measured.
+      move( state, cell / GRID_SIZE, cell % GRID_SIZE, dir );
+      return;
+    }
+  }
+
+  undo( state );
+}
+
+// One process of the benchmark. Runs n operations, each a move with the given percent chance,
+// an undo with the given percent chance, or a show otherwise, and sends its start and end times
+// and the latency of each operation to fd.
+static void benchProcess( Puzzle *state, int n, int movePercent, int undoPercent, int fd )
+{
+  uint64_t *latencies = ( uint64_t * ) malloc( n * sizeof( uint64_t ) );
+  unsigned int seed = getpid();
+  char boardMessage[ BOARD_TEXT_SIZE + 1 ];
+
+  uint64_t times[ 2 ] = { nanoTime(), 0 };
+  for ( int i = 0; i < n; i++ ) {
+    int roll = rand_r( &seed ) % 100;
+    uint64_t begin = nanoTime();
+    if ( roll < movePercent ) {
+      randomMove( state, &seed );
+    }
+    else if ( roll < movePercent + undoPercent ) {
+      undo( state );
+    }
+    else {
+      // Everything show does but the printing, which would swamp the rest.
+      Bitboard board = snapshotBoard( state, NULL );
+      boardToText( &board, boardMessage );
+    }
+    latencies[ i ] = nanoTime() - begin;
+  }
+  times[ 1 ] = nanoTime();
+
+  bool sent = writeAll( fd, times, sizeof( times ) ) && writeAll( fd, latencies, n * sizeof( uint64_t ) );
+  exit( sent ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+// Order latencies for qsort.
+static int compareLatencies( void const *a, void const *b )
+{
+  uint64_t x = *( uint64_t const * ) a;
+  uint64_t y = *( uint64_t const * ) b;
+  return x < y ? -1 : x > y;
+}
+
+// Measure how the game holds up with the given number of processes each running n operations
+// on it, in the given mix of moves, undos and shows. Prints the throughput and latency percentiles
+// as CSV, with a header line. Returns false if a process couldn't be started or didn't report.
+bool bench( Puzzle *state, int processes, int n, int movePercent, int undoPercent )
+{
+  int fds[ processes ];
+  pid_t pids[ processes ];
+
+  // Start the processes, each with its own pipe so their results don't interleave.
+  fflush( stdout );
+  for ( int p = 0; p < processes; p++ ) {
+    int pipefd[ 2 ];
+    if ( pipe( pipefd ) != 0 || ( pids[ p ] = fork() ) == -1 )
+      return false;
+    if ( pids[ p ] == 0 ) {
+      close( pipefd[ 0 ] );
+      benchProcess( state, n, movePercent, undoPercent, pipefd[ 1 ] );
+    }
+    close( pipefd[ 1 ] );
+    fds[ p ] = pipefd[ 0 ];
+  }
+
+  // Collect every latency, and the span from the first start to the last finish.
+  uint64_t total = ( uint64_t ) processes * n;
+  uint64_t *latencies = ( uint64_t * ) malloc( total * sizeof( uint64_t ) );
+  uint64_t first = UINT64_MAX, last = 0;
+  bool reported = true;
+  for ( int p = 0; p < processes; p++ ) {
+    uint64_t times[ 2 ];
+    if ( readAll( fds[ p ], times, sizeof( times ) ) &&
+         readAll( fds[ p ], latencies + ( uint64_t ) p * n, n * sizeof( uint64_t ) ) ) {
+      first = times[ 0 ] < first ? times[ 0 ] : first;
+      last = times[ 1 ] > last ? times[ 1 ] : last;
+    }
+    else {
+      reported = false;
+    }
+    close( fds[ p ] );
+    waitpid( pids[ p ], NULL, 0 );
+  }
+
+  if ( !reported ) {
+    free( latencies );
+    return false;
+  }
+
+  qsort( latencies, total, sizeof( uint64_t ), compareLatencies );
+  double seconds = ( last - first ) / 1e9;
+
+  printf( "backend,processes,operations,move,undo,show,seconds,ops_per_sec" );
+  for ( int i = 0; i < sizeof( benchPercentiles ) / sizeof( benchPercentiles[ 0 ] ); i++ )
+    printf( ",p%g_ns", benchPercentiles[ i ] / 10.0 );
+  printf( ",max_ns\n" );
 
-  // Print error and exit if command line arguments are invalid.
+  printf( "%s,%d,%d,%d,%d,%d,%.6f,%.0f", BACKEND, processes, n, movePercent, undoPercent,
+          100 - movePercent - undoPercent, seconds, total / seconds );
+  for ( int i = 0; i < sizeof( benchPercentiles ) / sizeof( benchPercentiles[ 0 ] ); i++ )
+    printf( ",%llu", ( unsigned long long ) latencies[ ( total - 1 ) * benchPercentiles[ i ] / 1000 ] );
+  printf( ",%llu\n", ( unsigned long long ) latencies[ total - 1 ] );
+
+  free( latencies );
+  return true;
+}
+
+// Run one command on the game, given as a command line without the session: argv[ 1 ] is the
+// command and the rest are its arguments. Prints its output, then success or error.
+// Returns the status of the command.
+int runCommand( Puzzle *puzzleMemory, int argc, char *argv[] )
+{
+  // Eventual exit status for success or failure.
+  int status = EXIT_SUCCESS;
+
+  // Print error if command line arguments are invalid.
   if ( argc < 2 || argc > 6 ) 
-    fail( "error" );
+    return commandError();
 
   // Command that the user inputs.
-  char command[ 5 + 1 ] = "";
+  char command[ 8 + 1 ] = "";
+  if ( strlen( argv[ 1 ] ) >= sizeof( command ) )
+    return commandError();
   strcpy( command, argv[ 1 ] );
 
   // Right, left, up, or down move command.
@@ -455,7 +921,7 @@ int main( int argc, char *argv[] ) {
     
     // Fail if there are an incorrect number of command line arguments.
     if ( argc != 4 ) 
-      fail( "error" );
+      return commandError();
 
     // Row of the peg to move.
     int row = atoi( argv[ 2 ] );
@@ -517,19 +983,122 @@ int main( int argc, char *argv[] ) {
       status = EXIT_FAILURE;
     }
   }
+  else if ( strcmp( command, "redo" ) == 0 ) {
+    // Perform the redo command if the command is redo
+    if ( redo( puzzleMemory ) ) {
+      // Set the status to success if the redo command worked.
+      status = EXIT_SUCCESS;
+    }
+    else {
+      status = EXIT_FAILURE;
+    }
+  }
+  // Make a whole list of moves at once if this command is inputted.
+  else if ( strcmp( command, "batch" ) == 0 ) {
+    // Read the moves from the file, or from standard input for -.
+    if ( argc != 3 )
+      return commandError();
+    FILE *fp = strcmp( argv[ 2 ], "-" ) == 0 ? stdin : fopen( argv[ 2 ], "r" );
+    if ( !fp )
+      return commandError();
+
+    unsigned char *codes;
+    int failed;
+    int count = readMoves( fp, &codes, &failed );
+    if ( fp != stdin )
+      fclose( fp );
+
+    // Make the moves if they could all be read, and say which one stopped the batch if not. An
+    // empty batch is an error too, rather than a change that throws the undone moves away.
+    if ( failed < 0 && count == 0 ) {
+      free( codes );
+      return commandError();
+    }
+    bool made = failed < 0 && batch( puzzleMemory, codes, count, &failed );
+    free( codes );
+    if ( !made ) {
+      if ( failed < 0 )
+        return commandError();
+      fprintf( errorStream ? errorStream : stderr, "error at move %d\n", failed + 1 );
+      return EXIT_FAILURE;
+    }
+
+    status = EXIT_SUCCESS;
+  }
+  // Run the benchmark if this command is inputted.
+  else if ( strcmp( command, "bench" ) == 0 ) {
+    if ( argc != 6 )
+      return commandError();
+
+    // Number of processes, operations for each, and percent of them that are moves and undos.
+    int processes = atoi( argv[ 2 ] );
+    int n = atoi( argv[ 3 ] );
+    int movePercent = atoi( argv[ 4 ] );
+    int undoPercent = atoi( argv[ 5 ] );
+    if ( processes <= 0 || processes > 1024 || n <= 0 || movePercent < 0 || undoPercent < 0 ||
+         movePercent + undoPercent > 100 )
+      return commandError();
+
+    if ( !bench( puzzleMemory, processes, n, movePercent, undoPercent ) )
+      return commandError();
+    return status;
+  }
+  // Give the session back if this command is inputted.
+  else if ( strcmp( command, "end" ) == 0 ) {
+    end( puzzleMemory );
+    status = EXIT_SUCCESS;
+  }
+  // Print the moves or boards of the game so far if one of these commands is inputted.
+  else if ( strcmp( command, "history" ) == 0 || strcmp( command, "replay" ) == 0 ) {
+    bool printed = strcmp( command, "history" ) == 0 ? history( puzzleMemory ) : replay( puzzleMemory );
+    if ( !printed )
+      return commandError();
+
+    return status;
+  }
   // Perform the show command if this command is inputted.
   else if( strcmp( command, "show" ) == 0 ) {
     // Run the show comand
     show( puzzleMemory );
 
-    // Return the status of the puzzle and exit
+    // Return the status of the puzzle
+    return status;
+  }
+  // Perform the solvable command if this command is inputted.
+  else if( strcmp( command, "solvable" ) == 0 ) {
+    // Answer from the endgame database.
+    int answer = ENDGAME_UNKNOWN;
+    if ( !solvable( puzzleMemory, &answer ) )
+      return commandError();
+
+    // Print whether the board can still be solved.
+    printf( "%s\n", answer == ENDGAME_SOLVABLE ? "solvable" : answer == ENDGAME_UNSOLVABLE ? "unsolvable" : "unknown" );
+    return status;
+  }
+  // Print every legal move if this command is inputted.
+  else if( strcmp( command, "moves" ) == 0 ) {
+    moves( puzzleMemory );
+    return status;
+  }
+  // Print a move that keeps the board solvable if this command is inputted.
+  else if( strcmp( command, "hint" ) == 0 ) {
+    int answer = ENDGAME_UNKNOWN;
+    unsigned char code = 0;
+    if ( !hint( puzzleMemory, &answer, &code ) )
+      return commandError();
+
+    // Print the move like the move commands, or none if every move loses.
+    if ( answer == ENDGAME_SOLVABLE )
+      printf( "%s %d %d\n", dirNames[ MOVE_DIR( code ) ], MOVE_ROW( code ), MOVE_COL( code ) );
+    else
+      printf( "%s\n", answer == ENDGAME_UNSOLVABLE ? "none" : "unknown" );
     return status;
   }
   // Perform the test command if this command is inputted.
   else if( ( strcmp( argv[ 1 ], "test" ) == 0 ) ) {
     // Fail as error if there are not a valid number of command line arguments
     if ( argc != 6 ) {
-      fail( "error" );
+      return commandError();
     }
 
     // Number of times the specified command should be run.
@@ -537,11 +1106,13 @@ int main( int argc, char *argv[] ) {
 
     // If the n value is invalid fail as error.
     if ( n == 0 || n < 0 ) {
-      fail("error");
+      return commandError();
     }
 
     // Direction of the specified move command
     char dirCommand[ 5 + 1 ] = "";
+    if ( strlen( argv[ 3 ] ) >= sizeof( dirCommand ) )
+      return commandError();
     strcpy( dirCommand, argv[ 3 ] );
 
     // Integer version of the command for the move function.
@@ -564,7 +1135,7 @@ int main( int argc, char *argv[] ) {
     }
     // Fail as error if the command is not valid.
     else {
-      fail( "error" );
+      return commandError();
     }
 
     // Row of the move command
@@ -580,19 +1151,115 @@ int main( int argc, char *argv[] ) {
   }
   else {
     // If the command is not one of the allowed commands fail as error.
-    fail( "error" );
+    return commandError();
   }
 
-  // Print success or error depending on the status of the program
+  // Print success or error depending on the status of the command
   if( status == 0 ) {
     printf( "success\n" );
   }
   else {
-    fail( "error" ); 
+    return commandError();
+  }
+
+  // Return the stataus of the command
+  return status;
+}
+
+// Read commands from fp, one per line in the same syntax as the command line, and run each one on
+// the game. Blank lines and lines starting with # are skipped. Returns failure if any command failed.
+int shell( Puzzle *puzzleMemory, FILE *fp )
+{
+  // Errors are answers to commands in the shell, so they go out in order with the rest.
+  errorStream = stdout;
+
+  // A script is read all at once, so its output can stay in the buffer. Anyone typing or
+  // piping commands in is waiting on each answer before sending the next command.
+  struct stat info;
+  bool script = fstat( fileno( fp ), &info ) == 0 && S_ISREG( info.st_mode );
+
+  int status = EXIT_SUCCESS;
+  char line[ 1024 ];
+  while ( true ) {
+    if ( !script )
+      fflush( stdout );
+    if ( !fgets( line, sizeof( line ), fp ) )
+      break;
+
+    // Split the line into words, after a stand-in for the program name. One word too many
+    // is kept, so runCommand sees there are too many.
+    char *args[ SHELL_ARGS + 2 ] = { "peg" };
+    int count = 1;
+    for ( char *word = strtok( line, " \t\r\n" ); word && count < SHELL_ARGS + 2; word = strtok( NULL, " \t\r\n" ) )
+      args[ count++ ] = word;
+
+    if ( count == 1 || args[ 1 ][ 0 ] == '#' )
+      continue;
+
+    if ( runCommand( puzzleMemory, count, args ) != EXIT_SUCCESS )
+      status = EXIT_FAILURE;
+  }
+
+  return status;
+}
+
+int main( int argc, char *argv[] ) {
+  #ifdef SEMAPHORE
+  /* Citing Help from the course website
+  * The code for opening the semaphore and checking for failure is based on the semPost.c example program from the synchronization section of the course website.
+  */
+  // Create the named Semaphore with an initial value of one.
+  sem_lock = sem_open( LOCK_NAME, 0, 0, 1 );
+  
+  // Fail as error if the semaphore cannot be created.
+  if ( sem_lock == SEM_FAILED )
+    fail( "Cannot create the named semaphore" );
+  #endif
+
+  // Map the session table made by reset.
+  SessionTable *table = openTable();
+  // Fail if the memory cannot be mapped.
+  if ( !table )
+    fail( "Cannot map to shared memory" );
+
+  // A leading number picks the session to play in, otherwise it is session zero.
+  int session = 0;
+  if ( argc > 1 && strspn( argv[ 1 ], "0123456789" ) == strlen( argv[ 1 ] ) ) {
+    char *end;
+    long id = strtol( argv[ 1 ], &end, 10 );
+    if ( end == argv[ 1 ] || *end || id < 0 || id >= SESSIONS )
+      fail( "No such session" );
+    session = id;
+    argv++;
+    argc--;
+  }
+
+  // Fail if the session doesn't hold a game.
+  if ( !__atomic_load_n( &table->sessions[ session ].used, __ATOMIC_ACQUIRE ) )
+    fail( "No such session" );
+  Puzzle *puzzleMemory = &table->sessions[ session ];
+
+  // Map the journal of moves next to the puzzle.
+  if ( !openJournal( &journal ) )
+    fail( "Cannot open the move journal" );
+
+  // Run the commands from a script or standard input if this command is inputted.
+  int status;
+  if ( argc >= 2 && strcmp( argv[ 1 ], "shell" ) == 0 ) {
+    FILE *fp = stdin;
+    if ( argc > 3 || ( argc == 3 && !( fp = fopen( argv[ 2 ], "r" ) ) ) )
+      fail( "error" );
+    status = shell( puzzleMemory, fp );
+  }
+  // Otherwise run the one command on the command line.
+  else {
+    status = runCommand( puzzleMemory, argc, argv );
   }
 
-  // Detatch from the shared memory.
-  shmdt( puzzleMemory );
+  // Unmap the shared memory, and the endgame database if a command mapped it.
+  closeTable( table );
+  if ( endgameLoaded )
+    closeEndgame( &endgame );
 
   // Return the stataus of the program
   return status;
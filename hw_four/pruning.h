@@ -0,0 +1,148 @@
+/**
+    @file pruning.h
+    @author Ian M Brain (imbrain)
+    Cheap tests that show a position can't be taken down to one peg, used to cut the solver's search.
+    Position classes: colour each cell by ( r + c ) mod 3 and by ( r - c ) mod 3. Every move flips
+    the parity of the peg count of all three colours in each colouring, so the parity differences
+    are fixed for the whole game, and only the cells whose single-peg position has the same
+    differences as the start can hold the last peg.
+    Pagoda functions: for each of those target cells, weight every cell by 1/phi raised to its
+    distance from the target (Conway's resource count). No move can raise the total weight of the
+    pegs, and a finish on the target is worth exactly 1, so once the total for every target is
+    below 1 the position is dead. Totals start from popcounts of each ring of cells around the
+    target and are then updated with the three cells each move changes.
+*/
+
+#ifndef PRUNING_H
+#define PRUNING_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "bitboard.h"
+#include "symmetry.h"
+
+// Weight lost for each step away from a target, the inverse of the golden ratio.
+#define RESOURCE_RATIO 0.6180339887498949
+
+// Allowance for rounding in the running totals.
+#define RESOURCE_SLACK 1e-9
+
+// Number of distinct distances between two cells.
+#define RINGS ( 2 * GRID_SIZE - 1 )
+
+struct Pruning {
+  /** Cells of each colour, three for ( r + c ) mod 3 then three for ( r - c ) mod 3. */
+  uint64_t classMasks[ 6 ];
+
+  /** Number of cells that can hold the last peg. */
+  int targetCount;
+
+  /** Cells that can hold the last peg. */
+  int targets[ CELLS ];
+
+  /** Cells at each distance from each target. */
+  uint64_t rings[ CELLS ][ RINGS ];
+
+  /** Pagoda weight of each cell for each target. */
+  double weights[ CELLS ][ CELLS ];
+
+  /** Number of positions cut off by position class. */
+  long classPruned;
+
+  /** Number of positions cut off by the pagoda functions. */
+  long pagodaPruned;
+} typedef Pruning;
+
+// Parity differences of the colour counts of a set of pegs, packed into four bits.
+static inline int classSignature( Pruning const *pruning, uint64_t pegs ) {
+  int signature = 0;
+  for ( int k = 0; k < 6; k += 3 ) {
+    int n0 = __builtin_popcountll( pegs & pruning->classMasks[ k ] );
+    int n1 = __builtin_popcountll( pegs & pruning->classMasks[ k + 1 ] );
+    int n2 = __builtin_popcountll( pegs & pruning->classMasks[ k + 2 ] );
+    signature = ( signature << 2 ) | ( ( ( n0 ^ n1 ) & 1 ) << 1 ) | ( ( n1 ^ n2 ) & 1 );
+  }
+  return signature;
+}
+
+// Set up the pruning tests for games starting from the given board.
+static inline void initPruning( Pruning *pruning, Bitboard const *start ) {
+  uint64_t valid = start->pegs | start->holes;
+
+  for ( int k = 0; k < 6; k++ )
+    pruning->classMasks[ k ] = 0;
+  for ( int cell = 0; cell < CELLS; cell++ ) {
+    int r = cell / GRID_SIZE;
+    int c = cell % GRID_SIZE;
+    pruning->classMasks[ ( r + c ) % 3 ] |= 1ULL << cell;
+    pruning->classMasks[ 3 + ( r - c + 3 * GRID_SIZE ) % 3 ] |= 1ULL << cell;
+  }
+
+  // The last peg can only be on a cell with the same class signature as the start.
+  int signature = classSignature( pruning, start->pegs );
+  pruning->targetCount = 0;
+  for ( int cell = 0; cell < CELLS; cell++ )
+    if ( ( valid & ( 1ULL << cell ) ) && classSignature( pruning, 1ULL << cell ) == signature )
+      pruning->targets[ pruning->targetCount++ ] = cell;
+
+  // Group the cells by distance from each target and weight them.
+  for ( int t = 0; t < pruning->targetCount; t++ ) {
+    int target = pruning->targets[ t ];
+    for ( int d = 0; d < RINGS; d++ )
+      pruning->rings[ t ][ d ] = 0;
+
+    for ( int cell = 0; cell < CELLS; cell++ ) {
+      int d = abs( cell / GRID_SIZE - target / GRID_SIZE ) + abs( cell % GRID_SIZE - target % GRID_SIZE );
+      pruning->rings[ t ][ d ] |= 1ULL << cell;
+
+      pruning->weights[ t ][ cell ] = 1;
+      for ( int i = 0; i < d; i++ )
+        pruning->weights[ t ][ cell ] *= RESOURCE_RATIO;
+    }
+  }
+
+  pruning->classPruned = 0;
+  pruning->pagodaPruned = 0;
+}
+
+// True if the start board's position class leaves no cell for the last peg.
+static inline bool classPrunes( Pruning *pruning ) {
+  if ( pruning->targetCount > 0 )
+    return false;
+
+  pruning->classPruned++;
+  return true;
+}
+
+// Compute the pagoda total of a set of pegs for each target.
+static inline void pegResources( Pruning const *pruning, uint64_t pegs, double *resources ) {
+  for ( int t = 0; t < pruning->targetCount; t++ ) {
+    resources[ t ] = 0;
+    double weight = 1;
+    for ( int d = 0; d < RINGS; d++ ) {
+      resources[ t ] += weight * __builtin_popcountll( pegs & pruning->rings[ t ][ d ] );
+      weight *= RESOURCE_RATIO;
+    }
+  }
+}
+
+// Update the pagoda totals for a move from cell that jumps the given step.
+static inline void moveResources( Pruning const *pruning, double const *resources, int cell, int step, double *child ) {
+  for ( int t = 0; t < pruning->targetCount; t++ ) {
+    double const *weights = pruning->weights[ t ];
+    child[ t ] = resources[ t ] - weights[ cell ] - weights[ cell + step ] + weights[ cell + 2 * step ];
+  }
+}
+
+// True if the pagoda totals show the last peg can't reach any target.
+static inline bool pagodaPrunes( Pruning *pruning, double const *resources ) {
+  for ( int t = 0; t < pruning->targetCount; t++ )
+    if ( resources[ t ] > 1 - RESOURCE_SLACK )
+      return false;
+
+  pruning->pagodaPruned++;
+  return true;
+}
+
+#endif
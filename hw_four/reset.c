@@ -2,9 +2,12 @@
     @file reset.c
     @author Ian M Brain (imbrain)
     This program provdes functionality to read in a game board and allow the peg.c program to interact with it.
-    Interaction is done through shared memory.
+    Interaction is done through shared memory, in a table of sessions that each hold one game.
+    The board is put in the session given on the command line, or in a free one, and the
+    session ID is printed for passing to peg.
     This program also contructs a named semaphore to provide mutual exclusion when updating the shared memory.
-    Interacts with peg.c through shared memory.
+    Interacts with peg.c through shared memory. It must be built with the same -DLOCKFREE or
+    -DSEMAPHORE flag as peg, so it replaces the game the way peg changes it.
 */
 
 #include <stdlib.h>
@@ -13,10 +16,14 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/types.h>
-#include <sys/shm.h>
 #include <errno.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "common.h"
+#include "bitboard.h"
+#include "journal.h"
+#include "transport.h"
 #include <semaphore.h>
 
 // Print out an error message and exit.
@@ -27,7 +34,7 @@ static void fail( char const *message ) {
 
 // Print out a usage message and exit.
 static void usage() {
-  fprintf( stderr, "usage: reset <puzzle-file>\n" );
+  fprintf( stderr, "usage: reset <puzzle-file> [session]\n" );
   exit( 1 );
 }
 
@@ -35,10 +42,20 @@ int main( int argc, char *argv[] ) {
   // Eight by eight array representing the puzzle board.
   char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ] = { };
 
-  // The command line aruments are invalid if there are not two arguments.
-  if ( argc != 2 )
+  // The command line aruments are invalid if there are not two or three arguments.
+  if ( argc != 2 && argc != 3 )
     usage();
 
+  // Session to reset, or -1 to allocate a free one.
+  int session = -1;
+  if ( argc == 3 ) {
+    char *end;
+    long id = strtol( argv[ 2 ], &end, 10 );
+    if ( end == argv[ 2 ] || *end || id < 0 || id >= SESSIONS )
+      usage();
+    session = id;
+  }
+
   // Open the specified file.
   int fd = open( argv[ 1 ], O_RDONLY, 0600 );
 
@@ -112,41 +129,111 @@ int main( int argc, char *argv[] ) {
     fail( errorMessage );
   }
 
-  /* Citing Help from the course website
-  * The code for opening and attaching to the shared memory is based on the shmReader.c example program from the Processes section of the course website.
-  */
-  // Create the memory shared between the server and client that is size of the puzzle struct.
-  int shmid = shmget( ftok( "/mnt/ncsudrive/i/imbrain", 1 ), sizeof( Puzzle ), 0666 | IPC_CREAT );
-  // Fail as error if memory cannot be gotten.
-  if ( shmid == -1 )
-    fail( "Shared memory could not be created " );
-
-  // Attach to the shared memory and get the puzzle struct.
-  Puzzle *puzzleMemory = ( Puzzle * )shmat( shmid, 0, 0 );
-  // Fail if the memory cannot be attached to.
-  if ( puzzleMemory == ( Puzzle * )-1 )
+  // Create the session table shared between the resets and pegs, if no reset has made it yet,
+  // and otherwise wait for the reset that made it to set it up, making a new one if it died.
+  bool created;
+  SessionTable *table;
+  while ( ( table = createTable( &created ) ) && !created && !waitTable( table ) )
+    closeTable( table );
+  // Fail if the memory cannot be created or mapped.
+  if ( !table )
     fail( "Cannot map Puzzle to shared memory" );
 
-  // Write the Puzzle struct into the shared memory.
-  for ( int i = 0; i < GRID_SIZE; i++ ) {
-    strcpy( puzzleMemory->puzzleBoard[ i ], puzzleBoard[ i ] );
-  }
+  Journal journal;
+  sem_t *sem_lock = SEM_FAILED;
+  if ( created ) {
+    // Make each session's lock usable from every process, and robust so that a peg that
+    // dies holding it doesn't leave it locked for good.
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    for ( int i = 0; i < SESSIONS; i++ )
+      if ( pthread_mutex_init( &table->sessions[ i ].lock, &attr ) != 0 )
+        fail( "Cannot create the puzzle lock" );
+    pthread_mutexattr_destroy( &attr );
+
+    // Start a new journal, so moves from old games can't be undone on these ones.
+    if ( !createJournal( &journal ) )
+      fail( "Cannot create the move journal" );
+
+    /* Citing Help from the course website
+    * The code for opening the semaphore and checking for failure is based on the semPost.c example program from the synchronization section of the course website.
+    */
+    // Create the named Semaphore with an initial value of one, for pegs built to use it.
+    sem_unlink( LOCK_NAME );
+    sem_lock = sem_open( LOCK_NAME, O_CREAT, 0600, 1 );
+
+    // Fail as error if the semaphore cannot be created.
+    if ( sem_lock == SEM_FAILED ) {
+      fail( "Cannot create the named semaphore" );
+    }
 
-  // Detatch from the shared memory.
-  shmdt( puzzleMemory );
+    __atomic_store_n( &table->ready, 1, __ATOMIC_RELEASE );
+  }
+  else {
+    if ( !openJournal( &journal ) )
+      fail( "Cannot open the move journal" );
+
+    #ifdef SEMAPHORE
+      sem_lock = sem_open( LOCK_NAME, 0 );
+      if ( sem_lock == SEM_FAILED )
+        fail( "Cannot open the named semaphore" );
+    #endif
+  }
 
-  /* Citing Help from the course website
-  * The code for opening the semaphore and checking for failure is based on the semPost.c example program from the synchronization section of the course website.
-  */
-  // Create the named Semaphore with an initial value of one.
-  sem_unlink( LOCK_NAME );
-  sem_t *sem_lock = sem_open( LOCK_NAME, O_CREAT, 0600, 1 );
+  // Take the session asked for, or the first free one.
+  if ( session < 0 ) {
+    for ( int i = 0; i < SESSIONS && session < 0; i++ ) {
+      uint32_t expected = 0;
+      if ( __atomic_compare_exchange_n( &table->sessions[ i ].used, &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+        session = i;
+    }
 
-  // Fail as error if the semaphore cannot be created.
-  if ( sem_lock == SEM_FAILED ) {
-    fail( "Cannot create the named semaphore" );
+    if ( session < 0 )
+      fail( "No free sessions" );
   }
-  
+  else {
+    __atomic_store_n( &table->sessions[ session ].used, 1, __ATOMIC_RELEASE );
+  }
+  Puzzle *puzzleMemory = &table->sessions[ session ];
+
+  // Hold the session's lock while the new game is written, so a peg can't move on half of it.
+  // Pegs built with -DSEMAPHORE take the named semaphore instead, so that is held then.
+  #ifdef SEMAPHORE
+    sem_wait( sem_lock );
+  #else
+    if ( pthread_mutex_lock( &puzzleMemory->lock ) == EOWNERDEAD )
+      pthread_mutex_consistent( &puzzleMemory->lock );
+  #endif
+
+  // Write the Puzzle struct into the shared memory, converting the board to its bitboard form.
+  // The sequence is made odd while it is written, so readers copy it again. It already is if
+  // a peg died writing the last game.
+  Bitboard board;
+  boardFromText( puzzleBoard, &board );
+  __atomic_fetch_add( &puzzleMemory->sequence, 1 + ( puzzleMemory->sequence & 1 ), __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+
+  // Put the new board in, giving the old game's nodes back to the journal.
+  GameState game = { board.pegs, 0, 0 };
+  replaceGame( &journal, puzzleMemory, game, &board );
+  __atomic_fetch_add( &puzzleMemory->sequence, 1, __ATOMIC_RELEASE );
+
+  #ifdef SEMAPHORE
+    sem_post( sem_lock );
+  #else
+    pthread_mutex_unlock( &puzzleMemory->lock );
+  #endif
+
+  // Unmap the shared memory.
+  closeJournal( &journal );
+  closeTable( table );
+
+  // Tell the user which session to give peg.
+  printf( "session %d\n", session );
+
   // Exit as success
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,98 @@
+/**
+    @file solve.c
+    @author Ian M Brain (imbrain)
+    This program finds out whether a puzzle board can be solved, leaving a single peg, and how.
+    Reads a board file in the same format as reset.c and searches it with the solver in solver.h.
+    Prints the moves of the solution in the same syntax as the peg commands, one per line.
+    With more than one thread, the search is split across threads and the work each one did is reported.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "solver.h"
+
+// Print out an error message and exit.
+static void fail( char const *message ) {
+  fprintf( stderr, "%s\n", message );
+  exit( 1 );
+}
+
+// Print out a usage message and exit.
+static void usage() {
+  fprintf( stderr, "usage: solve <puzzle-file> [table-bits] [threads]\n" );
+  exit( 1 );
+}
+
+int main( int argc, char *argv[] ) {
+  // Size of the transposition table, as a power of two.
+  int tableBits = TABLE_BITS;
+
+  // Number of threads to search with.
+  int threadCount = 1;
+
+  if ( argc < 2 || argc > 4 )
+    usage();
+  if ( argc >= 3 && ( sscanf( argv[ 2 ], "%d", &tableBits ) != 1 || tableBits < 1 || tableBits > TABLE_BITS_MAX ) )
+    usage();
+  if ( argc == 4 && ( sscanf( argv[ 3 ], "%d", &threadCount ) != 1 || threadCount < 1 ) )
+    usage();
+
+  // Read the board to solve.
+  Bitboard board;
+  if ( !readBoardFile( argv[ 1 ], &board ) ) {
+    char errorMessage[ 1024 + 20 ] = "";
+    snprintf( errorMessage, sizeof( errorMessage ), "Invalid input file: %s", argv[ 1 ] );
+    fail( errorMessage );
+  }
+
+  // Time the search.
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+
+  Solver solver;
+  if ( !initSolver( &solver, &board, tableBits ) )
+    fail( "Cannot allocate the transposition table" );
+  SolverThread *threads = NULL;
+  bool solved;
+  if ( threadCount == 1 ) {
+    solved = solveBoard( &solver, &board );
+  }
+  else {
+    threads = ( SolverThread * ) malloc( threadCount * sizeof( SolverThread ) );
+    solved = parallelSolveBoard( &solver, &board, threadCount, threads );
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  double seconds = ( end.tv_sec - begin.tv_sec ) + ( end.tv_nsec - begin.tv_nsec ) / 1e9;
+
+  // Print the moves in the peg command syntax.
+  if ( solved ) {
+    for ( int i = 0; i < solver.pathLen; i++ ) {
+      unsigned char code = solver.path[ i ];
+      printf( "%s %d %d\n", dirNames[ MOVE_DIR( code ) ], MOVE_ROW( code ), MOVE_COL( code ) );
+    }
+  }
+  else {
+    printf( "unsolvable\n" );
+  }
+
+  // Report how much work the search took.
+  fprintf( stderr, "%ld nodes, %ld table hits, %d symmetries, %.3f seconds\n",
+           solver.nodes, solver.tableHits, solver.symCount, seconds );
+  fprintf( stderr, "%d target cells, %ld cut by position class, %ld cut by pagoda\n",
+           solver.pruning.targetCount, solver.pruning.classPruned, solver.pruning.pagodaPruned );
+  if ( threads ) {
+    for ( int i = 0; i < threadCount; i++ ) {
+      double rate = threads[ i ].seconds > 0 ? threads[ i ].solver.nodes / threads[ i ].seconds : 0;
+      fprintf( stderr, "thread %d: %ld nodes, %ld steals, %.0f nodes/sec\n",
+               i, threads[ i ].solver.nodes, threads[ i ].steals, rate );
+    }
+    free( threads );
+  }
+
+  freeSolver( &solver );
+  return solved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
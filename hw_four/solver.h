@@ -0,0 +1,478 @@
+/**
+    @file solver.h
+    @author Ian M Brain (imbrain)
+    Depth-first solver for the peg puzzle, finding a sequence of moves that leaves a single peg.
+    Positions already shown to have no solution are kept in a fixed-size transposition table keyed
+    by a Zobrist hash. Boards that look the same under a rotation or reflection of the board shape
+    share one entry, since a hash is kept for the position as seen through each symmetry and the
+    smallest one is used as the key. Positions that position classes or pagoda functions show to be
+    dead are cut off before the table is even consulted (see pruning.h).
+    The search can also be split across threads. Each thread keeps a deque of positions near the
+    top of the tree, works from the bottom of its own deque and steals from the top of the others'
+    when it runs out. The transposition table is shared without locks, since each entry is a single
+    64-bit word, and every thread stops as soon as any of them finds a solution.
+*/
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "bitboard.h"
+#include "symmetry.h"
+#include "pruning.h"
+
+// Default number of bits of hash used to index the transposition table.
+#define TABLE_BITS 22
+
+// Largest table size that can be asked for, as a power of two: a table of 2 GB.
+#define TABLE_BITS_MAX 28
+
+struct Solver {
+  /** Cells that are part of the board. */
+  uint64_t valid;
+
+  /** Number of symmetries of the board shape, the first being the identity. */
+  int symCount;
+
+  /** Zobrist key of each cell as seen through each symmetry of the board. */
+  uint64_t symKeys[ SYMMETRIES ][ CELLS ];
+
+  /** Transposition table of the canonical hashes of positions with no solution. */
+  uint64_t *table;
+
+  /** Mask giving the table index from a hash. */
+  uint64_t tableMask;
+
+  /** Number of positions searched. */
+  long nodes;
+
+  /** Number of positions cut off by the transposition table. */
+  long tableHits;
+
+  /** Number of moves in the solution. */
+  int pathLen;
+
+  /** Moves of the solution, packed with MOVE_CODE(). */
+  unsigned char path[ CELLS ];
+
+  /** Flag that tells the search to give up, or NULL if it runs alone. */
+  int *stop;
+
+  /** Tests for cutting off dead positions, with counts of how often each one did. */
+  Pruning pruning;
+} typedef Solver;
+
+// Next value from a fixed pseudo-random sequence, used to make the Zobrist keys.
+static inline uint64_t nextKey( uint64_t *seed ) {
+  uint64_t z = ( *seed += 0x9E3779B97F4A7C15ULL );
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  return z ^ ( z >> 31 );
+}
+
+// Set up a solver for boards with the same shape as start, with a table of 2^tableBits entries.
+// Returns false if the table can't be allocated.
+static inline bool initSolver( Solver *solver, Bitboard const *start, int tableBits ) {
+  solver->valid = start->pegs | start->holes;
+
+  // One random key for each cell.
+  uint64_t seed = 0x5EED;
+  uint64_t keys[ CELLS ];
+  for ( int cell = 0; cell < CELLS; cell++ )
+    keys[ cell ] = nextKey( &seed );
+
+  // Each cell's key under a symmetry is the key of the cell it maps to.
+  int images[ SYMMETRIES ][ CELLS ];
+  solver->symCount = boardSymmetries( solver->valid, images );
+  for ( int sym = 0; sym < solver->symCount; sym++ )
+    for ( int cell = 0; cell < CELLS; cell++ )
+      solver->symKeys[ sym ][ cell ] = ( solver->valid & ( 1ULL << cell ) ) ? keys[ images[ sym ][ cell ] ] : 0;
+
+  solver->table = ( uint64_t * ) calloc( 1ULL << tableBits, sizeof( uint64_t ) );
+  if ( !solver->table )
+    return false;
+  solver->tableMask = ( 1ULL << tableBits ) - 1;
+  solver->nodes = 0;
+  solver->tableHits = 0;
+  solver->pathLen = 0;
+  solver->stop = NULL;
+  initPruning( &solver->pruning, start );
+  return true;
+}
+
+// Free the memory held by the solver.
+static inline void freeSolver( Solver *solver ) {
+  free( solver->table );
+}
+
+// Compute the hash of a set of pegs as seen through each symmetry.
+static inline void pegHashes( Solver const *solver, uint64_t pegs, uint64_t *hashes ) {
+  for ( int sym = 0; sym < solver->symCount; sym++ ) {
+    hashes[ sym ] = 0;
+    for ( uint64_t rest = pegs; rest; rest &= rest - 1 )
+      hashes[ sym ] ^= solver->symKeys[ sym ][ __builtin_ctzll( rest ) ];
+  }
+}
+
+// Hash shared by every symmetric copy of a position, the smallest of its hashes.
+static inline uint64_t canonicalHash( Solver const *solver, uint64_t const *hashes ) {
+  uint64_t key = hashes[ 0 ];
+  for ( int sym = 1; sym < solver->symCount; sym++ )
+    if ( hashes[ sym ] < key )
+      key = hashes[ sym ];
+
+  // Zero marks an empty table entry.
+  return key ? key : 1;
+}
+
+// True if the table says the position with this key has no solution.
+static inline bool tableHasDead( Solver const *solver, uint64_t key ) {
+  return __atomic_load_n( &solver->table[ key & solver->tableMask ], __ATOMIC_RELAXED ) == key;
+}
+
+// Record that the position with this key has no solution, replacing whatever was in its entry.
+static inline void tableAddDead( Solver *solver, uint64_t key ) {
+  __atomic_store_n( &solver->table[ key & solver->tableMask ], key, __ATOMIC_RELAXED );
+}
+
+// True if another thread has already finished the search.
+static inline bool solverStopped( Solver const *solver ) {
+  return solver->stop && __atomic_load_n( solver->stop, __ATOMIC_RELAXED );
+}
+
+// Search for a way to get from the board down to one peg. The board is left as it was.
+// The position's hashes and pagoda totals are passed in, so each move only has to update them.
+// On success, the moves from depth onward are stored in the solver's path.
+static inline bool solveFrom( Solver *solver, Bitboard *board, uint64_t const *hashes, double const *resources,
+                              int pegCount, int depth ) {
+  solver->nodes++;
+  if ( pegCount == 1 ) {
+    solver->pathLen = depth;
+    return true;
+  }
+
+  if ( solverStopped( solver ) || pagodaPrunes( &solver->pruning, resources ) )
+    return false;
+
+  uint64_t key = canonicalHash( solver, hashes );
+  if ( tableHasDead( solver, key ) ) {
+    solver->tableHits++;
+    return false;
+  }
+
+  // Try each legal move, one direction at a time.
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+    int step = dirStep[ dir ];
+    for ( uint64_t cells = movableCells( board, dir ); cells; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+
+      // Update the hash for each symmetry with the three cells that change.
+      uint64_t childHashes[ SYMMETRIES ];
+      for ( int sym = 0; sym < solver->symCount; sym++ ) {
+        uint64_t const *symKeys = solver->symKeys[ sym ];
+        childHashes[ sym ] = hashes[ sym ] ^ symKeys[ cell ] ^ symKeys[ cell + step ] ^ symKeys[ cell + 2 * step ];
+      }
+      double childResources[ CELLS ];
+      moveResources( &solver->pruning, resources, cell, step, childResources );
+
+      int r = cell / GRID_SIZE;
+      int c = cell % GRID_SIZE;
+      toggleMove( board, r, c, dir );
+      solver->path[ depth ] = MOVE_CODE( r, c, dir );
+      bool solved = solveFrom( solver, board, childHashes, childResources, pegCount - 1, depth + 1 );
+      toggleMove( board, r, c, dir );
+
+      if ( solved )
+        return true;
+    }
+  }
+
+  // A search that was stopped early hasn't shown there is no solution.
+  if ( !solverStopped( solver ) )
+    tableAddDead( solver, key );
+  return false;
+}
+
+// Search for a way to get from the board down to one peg, storing the moves in the solver's path.
+static inline bool solveBoard( Solver *solver, Bitboard const *start ) {
+  Bitboard board = *start;
+  if ( classPrunes( &solver->pruning ) )
+    return false;
+
+  uint64_t hashes[ SYMMETRIES ];
+  double resources[ CELLS ];
+  pegHashes( solver, board.pegs, hashes );
+  pegResources( &solver->pruning, board.pegs, resources );
+  return solveFrom( solver, &board, hashes, resources, __builtin_popcountll( board.pegs ), 0 );
+}
+
+// Positions shallower than this many moves are split into tasks for the threads to share.
+#define SPLIT_DEPTH 6
+
+// Most tasks each thread's deque can hold.
+#define DEQUE_SIZE 65536
+
+// A position waiting to be searched, with the moves that led to it.
+struct SolverTask {
+  /** Board of the position. */
+  Bitboard board;
+
+  /** Number of moves made to reach the position. */
+  int depth;
+
+  /** Moves made to reach the position. */
+  unsigned char path[ CELLS ];
+} typedef SolverTask;
+
+// Deque of tasks belonging to one thread. The owner works at the bottom and thieves take from the top.
+struct SolverDeque {
+  /** Tasks, from top to bottom. */
+  SolverTask *tasks;
+
+  /** Index of the top task and one past the bottom task. */
+  int top;
+  int bottom;
+
+  /** Semaphore to control mutual exclusion to the deque. */
+  sem_t lock;
+} typedef SolverDeque;
+
+// State of one thread of the parallel search.
+struct SolverThread {
+  /** Solver for this thread, sharing the transposition table with the rest. */
+  Solver solver;
+
+  /** Index of the thread. */
+  int index;
+
+  /** Number of tasks this thread took from other threads. */
+  long steals;
+
+  /** Seconds the thread spent searching. */
+  double seconds;
+
+  /** Shared state of the whole search. */
+  struct ParallelSearch *search;
+} typedef SolverThread;
+
+// State shared by all the threads of a parallel search.
+struct ParallelSearch {
+  /** Number of threads. */
+  int threadCount;
+
+  /** Each thread's deque of tasks. */
+  SolverDeque *deques;
+
+  /** Number of tasks that have been added but not finished. */
+  int pending;
+
+  /** Set once the search is over, either solved or out of tasks. */
+  int stop;
+
+  /** True if a solution was found. */
+  bool solved;
+
+  /** Moves of the solution. */
+  int pathLen;
+  unsigned char path[ CELLS ];
+
+  /** Semaphore to control mutual exclusion to the solution. */
+  sem_t result_sem;
+} typedef ParallelSearch;
+
+// Add a task to the bottom of a deque. Returns false if the deque is full.
+static inline bool pushTask( ParallelSearch *search, SolverDeque *deque, SolverTask const *task ) {
+  sem_wait( &deque->lock );
+  if ( deque->bottom == DEQUE_SIZE && deque->top > 0 ) {
+    // Slide the tasks back to the start of the array to make room.
+    memmove( deque->tasks, deque->tasks + deque->top, ( deque->bottom - deque->top ) * sizeof( SolverTask ) );
+    deque->bottom -= deque->top;
+    deque->top = 0;
+  }
+
+  bool added = deque->bottom < DEQUE_SIZE;
+  if ( added ) {
+    deque->tasks[ deque->bottom++ ] = *task;
+    __atomic_fetch_add( &search->pending, 1, __ATOMIC_SEQ_CST );
+  }
+  sem_post( &deque->lock );
+  return added;
+}
+
+// Take a task from the bottom (own deque) or top (stealing) of a deque. Returns false if it is empty.
+static inline bool takeTask( SolverDeque *deque, bool steal, SolverTask *task ) {
+  sem_wait( &deque->lock );
+  bool taken = deque->top < deque->bottom;
+  if ( taken )
+    *task = steal ? deque->tasks[ deque->top++ ] : deque->tasks[ --deque->bottom ];
+  sem_post( &deque->lock );
+  return taken;
+}
+
+// Record a solution and tell every thread to stop.
+static inline void finishSearch( ParallelSearch *search, unsigned char const *path, int pathLen ) {
+  sem_wait( &search->result_sem );
+  if ( !search->solved ) {
+    search->solved = true;
+    search->pathLen = pathLen;
+    memcpy( search->path, path, pathLen );
+  }
+  sem_post( &search->result_sem );
+  __atomic_store_n( &search->stop, 1, __ATOMIC_SEQ_CST );
+}
+
+// Search one task, either by splitting it into tasks for its children or by searching it directly.
+static inline void runTask( SolverThread *thread, SolverTask *task ) {
+  ParallelSearch *search = thread->search;
+  Solver *solver = &thread->solver;
+  int pegCount = __builtin_popcountll( task->board.pegs );
+  uint64_t hashes[ SYMMETRIES ] = { 0 };
+  double resources[ CELLS ];
+  pegHashes( solver, task->board.pegs, hashes );
+  pegResources( &solver->pruning, task->board.pegs, resources );
+
+  // Deep positions are searched directly, starting from the moves that led to them.
+  if ( task->depth >= SPLIT_DEPTH || pegCount == 1 ) {
+    memcpy( solver->path, task->path, task->depth );
+    if ( solveFrom( solver, &task->board, hashes, resources, pegCount, task->depth ) )
+      finishSearch( search, solver->path, solver->pathLen );
+    return;
+  }
+
+  // Shallow positions are split, skipping ones already known to be dead.
+  solver->nodes++;
+  if ( pagodaPrunes( &solver->pruning, resources ) )
+    return;
+  if ( tableHasDead( solver, canonicalHash( solver, hashes ) ) ) {
+    solver->tableHits++;
+    return;
+  }
+
+  // Push the children in reverse, so the owner pops them in the same order a single search would try them.
+  SolverTask child;
+  child.depth = task->depth + 1;
+  memcpy( child.path, task->path, task->depth );
+  for ( int dir = UP_DIR; dir >= RIGHT_DIR; dir-- ) {
+    uint64_t cells = movableCells( &task->board, dir );
+    while ( cells ) {
+      int cell = 63 - __builtin_clzll( cells );
+      cells &= ~( 1ULL << cell );
+
+      child.board = task->board;
+      toggleMove( &child.board, cell / GRID_SIZE, cell % GRID_SIZE, dir );
+      child.path[ task->depth ] = MOVE_CODE( cell / GRID_SIZE, cell % GRID_SIZE, dir );
+
+      // Search the child right away if there's no room for it.
+      if ( !pushTask( search, &search->deques[ thread->index ], &child ) )
+        runTask( thread, &child );
+    }
+  }
+}
+
+// Start routine for each thread of the parallel search.
+static inline void *solverRoutine( void *arg ) {
+  SolverThread *thread = ( SolverThread * ) arg;
+  ParallelSearch *search = thread->search;
+
+  struct timespec begin, end;
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+
+  SolverTask task;
+  while ( !__atomic_load_n( &search->stop, __ATOMIC_SEQ_CST ) ) {
+    // Work from our own deque first, then try stealing from each of the others.
+    bool found = takeTask( &search->deques[ thread->index ], false, &task );
+    for ( int i = 1; !found && i < search->threadCount; i++ ) {
+      found = takeTask( &search->deques[ ( thread->index + i ) % search->threadCount ], true, &task );
+      if ( found )
+        thread->steals++;
+    }
+
+    if ( found ) {
+      runTask( thread, &task );
+      __atomic_fetch_sub( &search->pending, 1, __ATOMIC_SEQ_CST );
+    }
+    else if ( __atomic_load_n( &search->pending, __ATOMIC_SEQ_CST ) == 0 ) {
+      // Nothing left anywhere, so there is no solution.
+      __atomic_store_n( &search->stop, 1, __ATOMIC_SEQ_CST );
+    }
+    else {
+      // Other threads are still working and may add more tasks.
+      sched_yield();
+    }
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  thread->seconds = ( end.tv_sec - begin.tv_sec ) + ( end.tv_nsec - begin.tv_nsec ) / 1e9;
+  return NULL;
+}
+
+// Search for a way to get from the board down to one peg using the given number of threads, sharing
+// the solver's transposition table. The solution is stored in the solver's path, and each thread's
+// statistics are stored in threads, which must have room for threadCount entries.
+static inline bool parallelSolveBoard( Solver *solver, Bitboard const *start, int threadCount, SolverThread *threads ) {
+  ParallelSearch search;
+  search.threadCount = threadCount;
+  search.pending = 0;
+  search.stop = 0;
+  search.solved = false;
+  sem_init( &search.result_sem, 0, 1 );
+
+  search.deques = ( SolverDeque * ) malloc( threadCount * sizeof( SolverDeque ) );
+  for ( int i = 0; i < threadCount; i++ ) {
+    search.deques[ i ].tasks = ( SolverTask * ) malloc( DEQUE_SIZE * sizeof( SolverTask ) );
+    search.deques[ i ].top = 0;
+    search.deques[ i ].bottom = 0;
+    sem_init( &search.deques[ i ].lock, 0, 1 );
+
+    // Each thread gets its own copy of the solver, all pointing at the same table.
+    threads[ i ].solver = *solver;
+    threads[ i ].solver.stop = &search.stop;
+    threads[ i ].index = i;
+    threads[ i ].steals = 0;
+    threads[ i ].seconds = 0;
+    threads[ i ].search = &search;
+  }
+
+  // The first thread starts with the whole board, unless its position class already rules it out.
+  SolverTask root;
+  root.board = *start;
+  root.depth = 0;
+  if ( !classPrunes( &solver->pruning ) )
+    pushTask( &search, &search.deques[ 0 ], &root );
+
+  // A thread that can't be started runs its share here instead, so only the ones that started are joined.
+  pthread_t worker[ threadCount ];
+  bool started[ threadCount ];
+  for ( int i = 0; i < threadCount; i++ ) {
+    started[ i ] = pthread_create( &worker[ i ], NULL, solverRoutine, &threads[ i ] ) == 0;
+    if ( !started[ i ] )
+      solverRoutine( &threads[ i ] );
+  }
+  for ( int i = 0; i < threadCount; i++ )
+    if ( started[ i ] )
+      pthread_join( worker[ i ], NULL );
+
+  // Total up the statistics and copy out the solution.
+  for ( int i = 0; i < threadCount; i++ ) {
+    solver->nodes += threads[ i ].solver.nodes;
+    solver->tableHits += threads[ i ].solver.tableHits;
+    solver->pruning.pagodaPruned += threads[ i ].solver.pruning.pagodaPruned;
+    free( search.deques[ i ].tasks );
+  }
+  free( search.deques );
+
+  if ( search.solved ) {
+    solver->pathLen = search.pathLen;
+    memcpy( solver->path, search.path, search.pathLen );
+  }
+  return search.solved;
+}
+
+#endif
@@ -0,0 +1,468 @@
+/**
+    @file suffix.h
+    @author Ian M Brain (imbrain)
+    Suffix array index used by the palindrome programs.
+    Builds a suffix array with SA-IS and an LCP array over the text vList#reverse(vList).
+    A sparse table over the LCP array answers longest common extension queries in constant time,
+    which is used to find the longest palindrome, the longest repeated substring and the
+    longest common substring of the sequence and its reverse.
+    The same queries let center expansion jump over runs of matching characters, so palindromes
+    with up to k mismatched pairs are found with O( k ) queries per center.
+    The data-parallel parts of the build (rank inversion, LCP and the sparse table) and the
+    palindrome search are split across a number of worker threads.
+*/
+
+#ifndef SUFFIX_H
+#define SUFFIX_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+// Symbol at the end of the text. Must be the smallest symbol in the text.
+#define SENTINEL_SYMBOL 0
+
+// Symbol between the sequence and its reverse.
+#define SEPARATOR_SYMBOL 1
+
+// Number of symbols reserved before the sequence characters.
+#define RESERVED_SYMBOLS 2
+
+struct SuffixIndex {
+  /** Length of the original sequence. */
+  int seqLen;
+
+  /** Length of the text, sequence + separator + reverse + sentinel. */
+  int n;
+
+  /** Text the index was built over, one symbol per position. */
+  int *text;
+
+  /** Suffix array, sa[ i ] is the start of the i-th smallest suffix. */
+  int *sa;
+
+  /** Inverse of the suffix array, rank[ sa[ i ] ] == i. */
+  int *rank;
+
+  /** lcp[ i ] is the longest common prefix of suffixes sa[ i - 1 ] and sa[ i ]. */
+  int *lcp;
+
+  /** Number of levels in the sparse table. */
+  int levels;
+
+  /** Sparse table of range minimums over the LCP array. */
+  int **sparse;
+} typedef SuffixIndex;
+
+// Compute the start (or end) of each bucket for the symbols of s.
+static inline void getBuckets( int const *s, int n, int alphabet, int *bkt, bool end ) {
+  // Count the occurrences of each symbol.
+  memset( bkt, 0, alphabet * sizeof( int ) );
+  for ( int i = 0; i < n; i++ )
+    bkt[ s[ i ] ]++;
+
+  // Turn the counts into bucket starts or ends.
+  int sum = 0;
+  for ( int i = 0; i < alphabet; i++ ) {
+    sum += bkt[ i ];
+    bkt[ i ] = end ? sum : sum - bkt[ i ];
+  }
+}
+
+// Induce the order of the L-type suffixes from the sorted suffixes already in sa.
+static inline void induceL( int const *s, int *sa, bool const *stype, int n, int alphabet, int *bkt ) {
+  getBuckets( s, n, alphabet, bkt, false );
+  for ( int i = 0; i < n; i++ ) {
+    int j = sa[ i ] - 1;
+    if ( sa[ i ] > 0 && !stype[ j ] )
+      sa[ bkt[ s[ j ] ]++ ] = j;
+  }
+}
+
+// Induce the order of the S-type suffixes from the sorted L-type suffixes in sa.
+static inline void induceS( int const *s, int *sa, bool const *stype, int n, int alphabet, int *bkt ) {
+  getBuckets( s, n, alphabet, bkt, true );
+  for ( int i = n - 1; i >= 0; i-- ) {
+    int j = sa[ i ] - 1;
+    if ( sa[ i ] > 0 && stype[ j ] )
+      sa[ --bkt[ s[ j ] ] ] = j;
+  }
+}
+
+/* Citing Help from outside sources
+* The code for the suffix array construction follows the SA-IS algorithm described in
+* "Linear Suffix Array Construction by Almost Pure Induced-Sorting" by Nong, Zhang and Chan.
+*/
+// Build the suffix array of s, which has symbols in [ 0, alphabet ) and ends with a unique smallest symbol.
+static inline void sais( int const *s, int *sa, int n, int alphabet ) {
+  // Classify each suffix as S-type (true) or L-type (false).
+  bool *stype = ( bool * ) malloc( n * sizeof( bool ) );
+  stype[ n - 1 ] = true;
+  for ( int i = n - 2; i >= 0; i-- )
+    stype[ i ] = s[ i ] < s[ i + 1 ] || ( s[ i ] == s[ i + 1 ] && stype[ i + 1 ] );
+
+  // A suffix is left-most S-type if it is S-type and the one before it is L-type.
+  #define IS_LMS( i ) ( ( i ) > 0 && stype[ ( i ) ] && !stype[ ( i ) - 1 ] )
+
+  int *bkt = ( int * ) malloc( alphabet * sizeof( int ) );
+
+  // Place the LMS suffixes at the ends of their buckets and induce an approximate order.
+  getBuckets( s, n, alphabet, bkt, true );
+  for ( int i = 0; i < n; i++ )
+    sa[ i ] = -1;
+  for ( int i = 1; i < n; i++ )
+    if ( IS_LMS( i ) )
+      sa[ --bkt[ s[ i ] ] ] = i;
+  induceL( s, sa, stype, n, alphabet, bkt );
+  induceS( s, sa, stype, n, alphabet, bkt );
+
+  // Move the sorted LMS substrings to the front of sa.
+  int n1 = 0;
+  for ( int i = 0; i < n; i++ )
+    if ( IS_LMS( sa[ i ] ) )
+      sa[ n1++ ] = sa[ i ];
+
+  // Name each LMS substring, giving equal substrings equal names.
+  for ( int i = n1; i < n; i++ )
+    sa[ i ] = -1;
+  int name = 0;
+  int prev = -1;
+  for ( int i = 0; i < n1; i++ ) {
+    int pos = sa[ i ];
+    bool diff = false;
+    for ( int d = 0; d < n; d++ ) {
+      if ( prev == -1 || s[ pos + d ] != s[ prev + d ] || stype[ pos + d ] != stype[ prev + d ] ) {
+        diff = true;
+        break;
+      }
+      else if ( d > 0 && ( IS_LMS( pos + d ) || IS_LMS( prev + d ) ) )
+        break;
+    }
+
+    if ( diff ) {
+      name++;
+      prev = pos;
+    }
+    sa[ n1 + pos / 2 ] = name - 1;
+  }
+  for ( int i = n - 1, j = n - 1; i >= n1; i-- )
+    if ( sa[ i ] >= 0 )
+      sa[ j-- ] = sa[ i ];
+
+  // Sort the reduced string, recursing only if the names are not already unique.
+  int *s1 = sa + n - n1;
+  int *sa1 = sa;
+  if ( name < n1 )
+    sais( s1, sa1, n1, name );
+  else
+    for ( int i = 0; i < n1; i++ )
+      sa1[ s1[ i ] ] = i;
+
+  // Map the reduced suffix array back to LMS positions and induce the final order.
+  getBuckets( s, n, alphabet, bkt, true );
+  for ( int i = 1, j = 0; i < n; i++ )
+    if ( IS_LMS( i ) )
+      s1[ j++ ] = i;
+  for ( int i = 0; i < n1; i++ )
+    sa1[ i ] = s1[ sa1[ i ] ];
+  for ( int i = n1; i < n; i++ )
+    sa[ i ] = -1;
+  for ( int i = n1 - 1; i >= 0; i-- ) {
+    int j = sa[ i ];
+    sa[ i ] = -1;
+    sa[ --bkt[ s[ j ] ] ] = j;
+  }
+  induceL( s, sa, stype, n, alphabet, bkt );
+  induceS( s, sa, stype, n, alphabet, bkt );
+
+  #undef IS_LMS
+
+  free( bkt );
+  free( stype );
+}
+
+// Arguments given to each worker during a parallel phase of the build.
+struct SuffixWork {
+  /** Index being built. */
+  SuffixIndex *index;
+
+  /** Which worker this is. */
+  int worker;
+
+  /** Total number of workers in the phase. */
+  int workers;
+
+  /** Sparse table level the worker should fill in. */
+  int level;
+} typedef SuffixWork;
+
+// Run the given routine on each of the workers and wait for all of them to finish.
+static inline void suffixParallel( SuffixIndex *index, int workers, int level, void *(*routine)( void * ) ) {
+  pthread_t worker[ workers ];
+  SuffixWork work[ workers ];
+  for ( int i = 0; i < workers; i++ ) {
+    work[ i ] = ( SuffixWork ) { index, i, workers, level };
+    if ( pthread_create( &( worker[ i ] ), NULL, routine, &( work[ i ] ) ) != 0 ) {
+      // Fall back to doing this worker's share on the current thread.
+      routine( &( work[ i ] ) );
+      worker[ i ] = 0;
+    }
+  }
+
+  for ( int i = 0; i < workers; i++ )
+    if ( worker[ i ] )
+      pthread_join( worker[ i ], NULL );
+}
+
+// First index of the given worker's share of n items.
+static inline int chunkStart( int n, int worker, int workers ) {
+  return ( int ) ( ( long ) n * worker / workers );
+}
+
+// Invert the worker's share of the suffix array.
+static inline void *rankRoutine( void *arg ) {
+  SuffixWork *work = ( SuffixWork * ) arg;
+  SuffixIndex *index = work->index;
+
+  int end = chunkStart( index->n, work->worker + 1, work->workers );
+  for ( int i = chunkStart( index->n, work->worker, work->workers ); i < end; i++ )
+    index->rank[ index->sa[ i ] ] = i;
+
+  return NULL;
+}
+
+/* Citing Help from outside sources
+* The LCP computation is Kasai's algorithm. Each worker starts its share of text positions with no
+* carried match length, which only costs a little extra comparison at the start of the share.
+*/
+// Compute the LCP values for the worker's share of text positions.
+static inline void *lcpRoutine( void *arg ) {
+  SuffixWork *work = ( SuffixWork * ) arg;
+  SuffixIndex *index = work->index;
+  int const *text = index->text;
+
+  // Length of the match carried from the previous text position.
+  int h = 0;
+  int end = chunkStart( index->n, work->worker + 1, work->workers );
+  for ( int i = chunkStart( index->n, work->worker, work->workers ); i < end; i++ ) {
+    int r = index->rank[ i ];
+    if ( r == 0 ) {
+      index->lcp[ r ] = 0;
+      h = 0;
+      continue;
+    }
+
+    // Extend the match with the suffix just before this one in sorted order.
+    int j = index->sa[ r - 1 ];
+    while ( i + h < index->n && j + h < index->n && text[ i + h ] == text[ j + h ] )
+      h++;
+    index->lcp[ r ] = h;
+
+    if ( h > 0 )
+      h--;
+  }
+
+  return NULL;
+}
+
+// Fill in the worker's share of one level of the sparse table.
+static inline void *sparseRoutine( void *arg ) {
+  SuffixWork *work = ( SuffixWork * ) arg;
+  SuffixIndex *index = work->index;
+  int *below = index->sparse[ work->level - 1 ];
+  int *row = index->sparse[ work->level ];
+  int half = 1 << ( work->level - 1 );
+
+  // Only ranges that fit entirely within the array are stored.
+  int count = index->n - ( 1 << work->level ) + 1;
+  int end = chunkStart( count, work->worker + 1, work->workers );
+  for ( int i = chunkStart( count, work->worker, work->workers ); i < end; i++ )
+    row[ i ] = below[ i ] < below[ i + half ] ? below[ i ] : below[ i + half ];
+
+  return NULL;
+}
+
+// Build the index over seq#reverse(seq) using the given number of workers.
+// Symbols of seq are mapped through symbolMap when it is given, which lets callers
+// pack the alphabet down to the symbols that actually occur.
+static inline void buildSuffixIndex( SuffixIndex *index, char const *seq, int len, int workers,
+                              int const *symbolMap, int alphabet ) {
+  index->seqLen = len;
+  index->n = 2 * len + 2;
+  int n = index->n;
+
+  // Without a symbol map, every byte value is its own symbol.
+  if ( !symbolMap )
+    alphabet = 256;
+
+  // Lay out the sequence, the separator, the reversed sequence and the sentinel.
+  index->text = ( int * ) malloc( n * sizeof( int ) );
+  for ( int i = 0; i < len; i++ ) {
+    unsigned char v = ( unsigned char ) seq[ i ];
+    int symbol = ( symbolMap ? symbolMap[ v ] : v ) + RESERVED_SYMBOLS;
+    index->text[ i ] = symbol;
+    index->text[ 2 * len - i ] = symbol;
+  }
+  index->text[ len ] = SEPARATOR_SYMBOL;
+  index->text[ n - 1 ] = SENTINEL_SYMBOL;
+
+  // Sort the suffixes.
+  index->sa = ( int * ) malloc( n * sizeof( int ) );
+  sais( index->text, index->sa, n, alphabet + RESERVED_SYMBOLS );
+
+  // Compute the rank and LCP arrays in parallel.
+  index->rank = ( int * ) malloc( n * sizeof( int ) );
+  index->lcp = ( int * ) malloc( n * sizeof( int ) );
+  suffixParallel( index, workers, 0, rankRoutine );
+  suffixParallel( index, workers, 0, lcpRoutine );
+
+  // Build the sparse table, one level at a time.
+  index->levels = 1;
+  while ( ( 1 << index->levels ) <= n )
+    index->levels++;
+  index->sparse = ( int ** ) malloc( index->levels * sizeof( int * ) );
+  index->sparse[ 0 ] = index->lcp;
+  for ( int level = 1; level < index->levels; level++ ) {
+    index->sparse[ level ] = ( int * ) malloc( ( n - ( 1 << level ) + 1 ) * sizeof( int ) );
+    suffixParallel( index, workers, level, sparseRoutine );
+  }
+}
+
+// Free the memory held by the index.
+static inline void freeSuffixIndex( SuffixIndex *index ) {
+  for ( int level = 1; level < index->levels; level++ )
+    free( index->sparse[ level ] );
+  free( index->sparse );
+  free( index->lcp );
+  free( index->rank );
+  free( index->sa );
+  free( index->text );
+}
+
+// Length of the longest common prefix of the suffixes of the text starting at i and j.
+static inline int longestCommonExtension( SuffixIndex const *index, int i, int j ) {
+  if ( i == j )
+    return index->n - i;
+
+  // The answer is the minimum LCP value between the two ranks.
+  int lo = index->rank[ i ];
+  int hi = index->rank[ j ];
+  if ( lo > hi ) {
+    int swap = lo;
+    lo = hi;
+    hi = swap;
+  }
+  lo++;
+
+  // Cover the range with two overlapping power-of-two windows.
+  int level = 31 - __builtin_clz( hi - lo + 1 );
+  int *row = index->sparse[ level ];
+  int a = row[ lo ];
+  int b = row[ hi - ( 1 << level ) + 1 ];
+  return a < b ? a : b;
+}
+
+// Text position of the reversed sequence that reads seq[ p ], seq[ p - 1 ], ... onward.
+// A p of -1 lands on the sentinel, so extensions stop at the start of the sequence.
+static inline int reversePosition( SuffixIndex const *index, int p ) {
+  return 2 * index->seqLen - p;
+}
+
+// Length of the longest palindrome centered at the given center. Centers 2 * i are the
+// odd-length palindromes around seq[ i ] and centers 2 * i + 1 are the even-length ones
+// between seq[ i ] and seq[ i + 1 ]. The start of the palindrome is stored in start.
+static inline int palindromeAt( SuffixIndex const *index, int center, int *start ) {
+  int i = center / 2;
+  if ( center % 2 == 0 ) {
+    int ext = longestCommonExtension( index, i + 1, reversePosition( index, i - 1 ) );
+    *start = i - ext;
+    return 2 * ext + 1;
+  }
+
+  int ext = longestCommonExtension( index, i + 1, reversePosition( index, i ) );
+  *start = i + 1 - ext;
+  return 2 * ext;
+}
+
+// Length of the longest palindrome at the given center that has at most k mismatched pairs.
+// Centers are numbered the same way as for palindromeAt. Each extension jumps straight to the
+// next mismatch, so the expansion takes at most k + 1 extension queries.
+static inline int approximatePalindromeAt( SuffixIndex const *index, int center, int k, int *start ) {
+  int i = center / 2;
+
+  // Positions that the palindrome will try to cover next on each side.
+  int left = center % 2 == 0 ? i - 1 : i;
+  int right = i + 1;
+  int length = center % 2 == 0 ? 1 : 0;
+
+  // Number of mismatched pairs used so far.
+  int used = 0;
+  while ( true ) {
+    // Jump over the run of matching pairs. The separator and sentinel stop the run at the ends.
+    int ext = longestCommonExtension( index, right, reversePosition( index, left ) );
+    left -= ext;
+    right += ext;
+    length += 2 * ext;
+
+    // Stop at either end of the sequence or once all the mismatches are used.
+    if ( left < 0 || right >= index->seqLen || used == k )
+      break;
+
+    // Take the mismatched pair and keep going.
+    used++;
+    left--;
+    right++;
+    length += 2;
+  }
+
+  *start = left + 1;
+  return length;
+}
+
+// Length of the longest substring that occurs at least twice in the sequence.
+// The start of one occurrence is stored in start.
+static inline int longestRepeat( SuffixIndex const *index, int *start ) {
+  int best = 0;
+  *start = 0;
+
+  // Suffixes of the reverse can sit between two sequence suffixes in sorted order, so track
+  // the smallest LCP value since the last sequence suffix, or -1 if there hasn't been one.
+  int run = -1;
+  for ( int i = 0; i < index->n; i++ ) {
+    if ( run >= 0 && index->lcp[ i ] < run )
+      run = index->lcp[ i ];
+
+    if ( index->sa[ i ] < index->seqLen ) {
+      // The separator is unique, so a match between two sequence suffixes stays in the sequence.
+      if ( run > best ) {
+        best = run;
+        *start = index->sa[ i ];
+      }
+      run = index->n;
+    }
+  }
+
+  return best;
+}
+
+// Length of the longest substring of the sequence that also occurs in its reverse.
+// The start of the occurrence in the sequence is stored in start.
+static inline int longestCommonWithReverse( SuffixIndex const *index, int *start ) {
+  int best = 0;
+  *start = 0;
+  for ( int i = 1; i < index->n; i++ ) {
+    int a = index->sa[ i ];
+    int b = index->sa[ i - 1 ];
+
+    // One suffix must start in the sequence and the other in the reverse.
+    if ( ( a < index->seqLen ) != ( b < index->seqLen ) && index->lcp[ i ] > best ) {
+      best = index->lcp[ i ];
+      *start = a < index->seqLen ? a : b;
+    }
+  }
+
+  return best;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/**
+    @file symmetry.h
+    @author Ian M Brain (imbrain)
+    Rotations and reflections of the puzzle board shape.
+    A symmetry is a flip of the rows and/or columns of the area the board occupies, optionally
+    followed by a transpose, and only the ones that map the valid cells onto themselves are kept.
+    Doesn't depend on common.h, so the hw_two server can use it with its own board.
+*/
+
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Height and width of the playing area, if common.h hasn't already given it.
+#ifndef GRID_SIZE
+#define GRID_SIZE 8
+#endif
+
+// Most symmetries a board can have, four reflections each with or without a transpose.
+#define SYMMETRIES 8
+
+// Number of cells on the board.
+#define CELLS ( GRID_SIZE * GRID_SIZE )
+
+// Lookup tables for moving a whole set of pegs through each symmetry, one row at a time.
+struct SymmetryTables {
+  /** Number of symmetries of the board shape, the first being the identity. */
+  int count;
+
+  /** Image of each possible row of pegs, for each symmetry and row. */
+  uint64_t rowImages[ SYMMETRIES ][ GRID_SIZE ][ 256 ];
+} typedef SymmetryTables;
+
+// Find the symmetries of the board made of the valid cells. Stores the cell each cell maps to
+// under each symmetry in images and returns how many there are, the first being the identity.
+// Invalid cells map to themselves.
+static inline int boardSymmetries( uint64_t valid, int images[ SYMMETRIES ][ CELLS ] ) {
+  // Find the rows and columns the board occupies.
+  int r0 = GRID_SIZE, r1 = -1, c0 = GRID_SIZE, c1 = -1;
+  for ( int cell = 0; cell < CELLS; cell++ ) {
+    if ( valid & ( 1ULL << cell ) ) {
+      int r = cell / GRID_SIZE;
+      int c = cell % GRID_SIZE;
+      r0 = r < r0 ? r : r0;
+      r1 = r > r1 ? r : r1;
+      c0 = c < c0 ? c : c0;
+      c1 = c > c1 ? c : c1;
+    }
+  }
+
+  // Try each reflection of the occupied area, transposed or not, keeping the ones that map the board onto itself.
+  int count = 0;
+  for ( int sym = 0; sym < SYMMETRIES; sym++ ) {
+    bool transpose = sym & 4;
+    if ( transpose && r1 - r0 != c1 - c0 )
+      continue;
+
+    bool fits = true;
+    for ( int cell = 0; cell < CELLS; cell++ ) {
+      images[ count ][ cell ] = cell;
+      if ( !( valid & ( 1ULL << cell ) ) )
+        continue;
+
+      int r = cell / GRID_SIZE - r0;
+      int c = cell % GRID_SIZE - c0;
+      if ( sym & 1 )
+        r = r1 - r0 - r;
+      if ( sym & 2 )
+        c = c1 - c0 - c;
+      if ( transpose ) {
+        int swap = r;
+        r = c;
+        c = swap;
+      }
+
+      int image = ( r + r0 ) * GRID_SIZE + c + c0;
+      if ( !( valid & ( 1ULL << image ) ) )
+        fits = false;
+      images[ count ][ cell ] = image;
+    }
+
+    if ( fits )
+      count++;
+  }
+
+  return count;
+}
+
+// Build the tables for mapping sets of pegs through the symmetries of the board made of the valid cells.
+static inline void initSymmetryTables( SymmetryTables *tables, uint64_t valid ) {
+  int images[ SYMMETRIES ][ CELLS ];
+  tables->count = boardSymmetries( valid, images );
+
+  for ( int sym = 0; sym < tables->count; sym++ ) {
+    for ( int r = 0; r < GRID_SIZE; r++ ) {
+      for ( int bits = 0; bits < 256; bits++ ) {
+        uint64_t image = 0;
+        for ( int c = 0; c < GRID_SIZE; c++ )
+          if ( bits & ( 1 << c ) )
+            image |= 1ULL << images[ sym ][ r * GRID_SIZE + c ];
+        tables->rowImages[ sym ][ r ][ bits ] = image;
+      }
+    }
+  }
+}
+
+// Map a set of pegs through one symmetry.
+static inline uint64_t symmetricPegs( SymmetryTables const *tables, int sym, uint64_t pegs ) {
+  uint64_t const ( *rows )[ 256 ] = tables->rowImages[ sym ];
+  uint64_t image = 0;
+  for ( int r = 0; r < GRID_SIZE; r++ )
+    image |= rows[ r ][ ( pegs >> ( r * GRID_SIZE ) ) & 0xFF ];
+  return image;
+}
+
+// Set of pegs shared by every symmetric copy of a position, the smallest of its images.
+static inline uint64_t canonicalPegs( SymmetryTables const *tables, uint64_t pegs ) {
+  uint64_t key = pegs;
+  for ( int sym = 1; sym < tables->count; sym++ ) {
+    uint64_t image = symmetricPegs( tables, sym, pegs );
+    if ( image < key )
+      key = image;
+  }
+  return key;
+}
+
+#endif
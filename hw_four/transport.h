@@ -0,0 +1,186 @@
+/**
+    @file transport.h
+    @author Ian M Brain (imbrain)
+    Shared memory holding the session table, as a POSIX shared memory object mapped with mmap.
+    The object is named by PEG_SHM, so separate deployments on one host can each have their own
+    table, and the journal's object is named after it. Setting PEG_POPULATE maps the memory with
+    MAP_POPULATE, so its pages are faulted in once when it is attached instead of on first touch,
+    and setting PEG_HUGEPAGES asks for the table on huge pages with MAP_HUGETLB. Most systems put
+    POSIX shared memory on a tmpfs that can't give MAP_HUGETLB pages, so then the table is mapped
+    normally and the kernel is asked to back it with transparent huge pages instead.
+*/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+
+// Name of the session table's shared memory object when PEG_SHM isn't set.
+#define TABLE_NAME "/imbrain-peg-table"
+
+// Added to the table's name to name the journal's shared memory object.
+#define JOURNAL_SUFFIX "-journal"
+
+// Longest shared memory object name, with its null terminator.
+#define SHARED_NAME_SIZE 256
+
+// Longest a reset waits, in milliseconds, for another reset that just created the table to size it
+// or set it up, before deciding that reset died and replacing the table.
+#define TABLE_WAIT_MS 1000
+
+// Value of ready once a reset has given up on the table's creator and taken its name away.
+#define TABLE_ABANDONED 2
+
+// Size the table is rounded up to when it goes on huge pages.
+#define HUGE_PAGE_SIZE ( 2 * 1024 * 1024 )
+
+// True if the environment variable is set to anything but "" or "0".
+static inline bool sharedOption( char const *variable ) {
+  char const *value = getenv( variable );
+  return value && value[ 0 ] && strcmp( value, "0" ) != 0;
+}
+
+// Build the name of a shared memory object, from PEG_SHM or the default followed by suffix.
+static inline char const *sharedName( char *name, char const *suffix ) {
+  char const *base = getenv( "PEG_SHM" );
+  if ( !base || !base[ 0 ] )
+    base = TABLE_NAME;
+
+  // Object names need a leading slash, so add one if PEG_SHM left it off.
+  snprintf( name, SHARED_NAME_SIZE, "%s%s%s", base[ 0 ] == '/' ? "" : "/", base, suffix );
+  return name;
+}
+
+// Map size bytes of a shared memory object, with the options from the environment.
+// Huge pages are only tried if huge is set. Returns NULL if it can't be mapped.
+static inline void *sharedMap( int fd, size_t size, bool huge ) {
+  int flags = MAP_SHARED | ( sharedOption( "PEG_POPULATE" ) ? MAP_POPULATE : 0 );
+  huge = huge && sharedOption( "PEG_HUGEPAGES" );
+
+  void *map = huge ? mmap( NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, fd, 0 ) : MAP_FAILED;
+  if ( map == MAP_FAILED ) {
+    map = mmap( NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0 );
+    if ( map == MAP_FAILED )
+      return NULL;
+    if ( huge )
+      madvise( map, size, MADV_HUGEPAGE );
+  }
+
+  return map;
+}
+
+// Size of the table's shared memory object.
+static inline size_t tableSize() {
+  size_t size = sizeof( SessionTable );
+  if ( sharedOption( "PEG_HUGEPAGES" ) )
+    size = ( size + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  return size;
+}
+
+// Map the session table, creating it if it doesn't exist yet or was left by a build with a smaller
+// table. Sets created if this call made a new, zeroed table. Returns NULL if it can't be mapped.
+// A table with no size yet is still being created by another reset, which is waited for.
+static inline SessionTable *createTable( bool *created ) {
+  char name[ SHARED_NAME_SIZE ];
+  sharedName( name, "" );
+
+  struct stat info;
+  size_t size = tableSize();
+  int fd;
+  int waited = 0;
+  while ( true ) {
+    fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0666 );
+    *created = fd != -1;
+    if ( *created || errno != EEXIST )
+      break;
+
+    // Open the one that is there, starting over if it was removed in the meantime.
+    fd = shm_open( name, O_RDWR, 0 );
+    if ( fd == -1 && errno == ENOENT )
+      continue;
+    if ( fd == -1 || fstat( fd, &info ) != 0 )
+      break;
+
+    // Use the table as it was made, unless it is too small to be this build's.
+    if ( ( size_t ) info.st_size >= sizeof( SessionTable ) ) {
+      size = info.st_size;
+      break;
+    }
+    close( fd );
+
+    // Wait for the reset that created it to give it its size.
+    if ( info.st_size == 0 && waited < TABLE_WAIT_MS ) {
+      struct timespec pause = { 0, 1000000 };
+      nanosleep( &pause, NULL );
+      waited++;
+      continue;
+    }
+
+    // Replace a table from a build with fewer sessions, or one whose creator died before sizing it.
+    shm_unlink( name );
+  }
+
+  if ( fd == -1 || ( *created && ftruncate( fd, size ) != 0 ) )
+    return NULL;
+
+  SessionTable *table = ( SessionTable * ) sharedMap( fd, size, true );
+  close( fd );
+  if ( table && *created )
+    table->size = size;
+  return table;
+}
+
+// Wait for the reset that created the table to finish setting it up. If it hasn't after
+// TABLE_WAIT_MS it died part way, and the first reset to notice takes the table's name away, so the
+// next createTable makes a new one. Returns whether the table is ready.
+static inline bool waitTable( SessionTable *table ) {
+  for ( int waited = 0; waited < TABLE_WAIT_MS; waited++ ) {
+    uint32_t ready = __atomic_load_n( &table->ready, __ATOMIC_ACQUIRE );
+    if ( ready )
+      return ready == 1;
+
+    struct timespec pause = { 0, 1000000 };
+    nanosleep( &pause, NULL );
+  }
+
+  // The creator may still finish just before this.
+  uint32_t expected = 0;
+  if ( __atomic_compare_exchange_n( &table->ready, &expected, TABLE_ABANDONED, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+    char name[ SHARED_NAME_SIZE ];
+    shm_unlink( sharedName( name, "" ) );
+  }
+  return expected == 1;
+}
+
+// Map the session table made by reset. Returns NULL if there isn't one, or it is too small.
+static inline SessionTable *openTable() {
+  char name[ SHARED_NAME_SIZE ];
+  int fd = shm_open( sharedName( name, "" ), O_RDWR, 0 );
+  if ( fd == -1 )
+    return NULL;
+
+  struct stat info;
+  void *map = NULL;
+  if ( fstat( fd, &info ) == 0 && ( size_t ) info.st_size >= sizeof( SessionTable ) )
+    map = sharedMap( fd, info.st_size, true );
+  close( fd );
+  return ( SessionTable * ) map;
+}
+
+// Unmap the session table.
+static inline void closeTable( SessionTable *table ) {
+  munmap( table, table->size );
+}
+
+#endif
@@ -1,8 +1,17 @@
 // Height and width of the playing area.
 #define GRID_SIZE 8
 
-// Length of the undo history.
+// Number of games the session table holds. Can be raised with -DSESSIONS=n, but peg and reset
+// must be built with the same value since it sets the size of the shared table.
+#ifndef SESSIONS
+#define SESSIONS 256
+#endif
+
+// Number of moves that can be undone. Can be raised with -DUNDO_SIZE=n, but peg and reset
+// must be built with the same value since it sets the size of the shared Puzzle.
+#ifndef UNDO_SIZE
 #define UNDO_SIZE 3
+#endif
 
 // Direction options for the move.  You're not required to use these
 // now, but you will need them for a later assignment.
@@ -11,10 +20,31 @@
 #define LEFT_DIR 2
 #define UP_DIR 3
 
+// Pack a move from ( r, c ) in direction dir into one byte, and get the parts back out.
+#define MOVE_CODE( r, c, dir ) ( ( unsigned char ) ( ( ( ( r ) * GRID_SIZE + ( c ) ) << 2 ) | ( dir ) ) )
+#define MOVE_ROW( code ) ( ( ( code ) >> 2 ) / GRID_SIZE )
+#define MOVE_COL( code ) ( ( ( code ) >> 2 ) % GRID_SIZE )
+#define MOVE_DIR( code ) ( ( code ) & 3 )
+
 struct Puzzle {
+  /** Nonzero while a reset has the session allocated. */
+  unsigned int used;
+
   /** Eight by eight array representing the puzzle board. */
   char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ];
 
-  /** Array containing most recent three moves. */
-  char undoHistory[ UNDO_SIZE ][ 1024 ];
+  /** Most recent moves packed with MOVE_CODE(), as a ring buffer that overwrites the oldest. */
+  unsigned char undoLog[ UNDO_SIZE ];
+
+  /** Slot of the undo log the next move is written to. */
+  int undoNext;
+
+  /** Number of moves in the undo log that can still be undone. */
+  int undoCount;
 } typedef Puzzle;
+
+// Every game on the host, in one shared memory segment.
+struct SessionTable {
+  /** The games, indexed by session ID. */
+  Puzzle sessions[ SESSIONS ];
+} typedef SessionTable;
@@ -3,7 +3,10 @@
     @author Ian M Brain (imbrain)
     This program acts similarly as a client.
     Allows users to play a peg-jumping puzzle.
-    Attaches to shared memory and gets the puzzle board struct from it.
+    Attaches to shared memory and gets the puzzle board struct from it, from the session given
+    as the first argument, or session zero if there isn't one.
+    The shell command attaches once and then runs commands read from a script file or standard
+    input, one per line, so players making many moves don't start a process for each.
     Performs allowed operations on the puzzle and updates the shared memory.
     Citing Help from other Assignments
     The code for this program is based on client.c in homework 2 that I completed on 2/1/2024.
@@ -17,69 +20,78 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
 #include "common.h"
 
+// Most words on a shell command line, the longest command and its arguments.
+#define SHELL_ARGS 3
+
+/** Where command errors are printed, or NULL for standard error. */
+FILE *errorStream;
+
 // Print out an error message and exit.
 static void fail( char const *message ) {
   fprintf( stderr, "%s\n", message );
   exit( 1 );
 }
 
-int main( int argc, char *argv[] ) {
-  // Eventual exit status for success or failure.
-  int status = EXIT_SUCCESS;
+// Print the error message for a command that failed, and return its status.
+static int commandError() {
+  fprintf( errorStream ? errorStream : stderr, "error\n" );
+  return EXIT_FAILURE;
+}
 
-  /* Citing Help from the course website
-  * The code for opening and attaching to the shared memory is based on the shmWriter.c example program from the Processes section of the course website.
-  */
-  // Open the shared memory.
-  int shmid = shmget( ftok( "/mnt/ncsudrive/i/imbrain", 1 ), sizeof( Puzzle ), 0 );
-  if ( shmid == -1 )
-    fail( "Shared memory could not be attached " );
+// Add a move to the undo log, overwriting the oldest move once it is full.
+static void recordMove( Puzzle *puzzle, int row, int column, int dir ) {
+  puzzle->undoLog[ puzzle->undoNext ] = MOVE_CODE( row, column, dir );
+  puzzle->undoNext = ( puzzle->undoNext + 1 ) % UNDO_SIZE;
+  if ( puzzle->undoCount < UNDO_SIZE )
+    puzzle->undoCount++;
+}
 
-  // Attach to the puzzle memory point to the contained struct.
-  Puzzle *puzzleMemory = ( Puzzle * )shmat( shmid, 0, 0 );
-  // Fail if the memory cannot be pointed to
-  if ( puzzleMemory == ( Puzzle * )-1 )
-    fail( "Cannot map to shared memory" );
+// Run one command on the game, given as a command line without the session: argv[ 1 ] is the
+// command and the rest are its arguments. Prints its output, then success or error.
+// Returns the status of the command.
+int runCommand( Puzzle *puzzleMemory, int argc, char *argv[] )
+{
+  // Eventual exit status for success or failure.
+  int status = EXIT_SUCCESS;
 
-  // Print error and exit if command line arguments are invalid.
+  // Print error if command line arguments are invalid.
   if ( argc < 2 || argc > 4 ) 
-      fail( "error" );
+      return commandError();
 
   // Command that the user inputs.
   char command[ 5 + 1 ] = "";
+  if ( strlen( argv[ 1 ] ) >= sizeof( command ) )
+    return commandError();
   strcpy( command, argv[ 1 ] );
 
   // Right, left, up, or down move command.
   if ( strcmp( argv[ 1 ], "left" ) == 0 || strcmp( argv[ 1 ], "right" ) == 0 || strcmp( argv[ 1 ], "up" ) == 0 || strcmp( argv[ 1 ], "down" ) == 0 ) {
-    // Entire command to be inserted into the undo history.
-    char full_command[ 9 + 1 ] = "";
-    strcpy( full_command, argv[ 1 ] );
-    strcat( full_command, " " );
-    strcat( full_command, argv[ 2 ] );
-    strcat( full_command, " " );
-    strcat( full_command, argv[ 3 ] );
-    
     // Fail if there are an incorrect number of command line arguments.
     if ( argc != 4 ) 
-        fail( "error" );
+        return commandError();
 
     // Row of the peg to move.
     int row = atoi( argv[ 2 ] );
     // Column of the peg to move.
     int column = atoi( argv[ 3 ] );
 
+    // The peg has to be on the board.
+    if ( row < 0 || row >= GRID_SIZE || column < 0 || column >= GRID_SIZE )
+      return commandError();
+
     if( strcmp( command, "right" ) == 0 ) {
       // A right command is invalid if the column is more than five or less than zero.
       if ( column > 5 || column < 0 ) {
-        fail( "error" );
+        return commandError();
       }
       // A right command is invalid if the index to the right is not a peg or the index after that is not empty
       else if ( puzzleMemory->puzzleBoard[ row ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row ][ column + 1 ] != 'o' || puzzleMemory->puzzleBoard[ row ][ column + 2 ] != '.' ) {
-        fail( "error" );
+        return commandError();
       }
       // Otherwise, perform the valid move and udpate the undo history with the successful move.
       else {
@@ -89,9 +101,7 @@ int main( int argc, char *argv[] ) {
         puzzleMemory->puzzleBoard[ row ][ column + 2 ] = 'o';
 
         // Update the undo history to include the most recent move.
-        strcpy( puzzleMemory->undoHistory[ 2 ], puzzleMemory->undoHistory[ 1 ] );
-        strcpy( puzzleMemory->undoHistory[ 1 ], puzzleMemory->undoHistory[ 0 ] );
-        strcpy( puzzleMemory->undoHistory[ 0 ], full_command );
+        recordMove( puzzleMemory, row, column, RIGHT_DIR );
 
         // Send a success message.
         status = EXIT_SUCCESS;
@@ -100,11 +110,11 @@ int main( int argc, char *argv[] ) {
     else if( strcmp( command, "left" ) == 0 ) {
       // A left command is invalid if the column is more than five or less than zero.
       if ( column > 7 || column < 2 ) {
-        fail( "error" );
+        return commandError();
       }
       // A left command is invalid if the index to the left is not a peg or the index after that is not empty
       else if ( puzzleMemory->puzzleBoard[ row ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row ][ column - 1 ] != 'o' || puzzleMemory->puzzleBoard[ row ][ column - 2 ] != '.' ) {
-        fail( "error" );
+        return commandError();
       }
       // Otherwise, perform the valid move and udpate the undo history with the successful move.
       else {
@@ -114,9 +124,7 @@ int main( int argc, char *argv[] ) {
         puzzleMemory->puzzleBoard[ row ][ column - 2 ] = 'o';
 
         // Update the undo history to include the most recent move.
-        strcpy( puzzleMemory->undoHistory[ 2 ], puzzleMemory->undoHistory[ 1 ] );
-        strcpy( puzzleMemory->undoHistory[ 1 ], puzzleMemory->undoHistory[ 0 ] );
-        strcpy( puzzleMemory->undoHistory[ 0 ], full_command );
+        recordMove( puzzleMemory, row, column, LEFT_DIR );
 
         // Send a success message.
         status = EXIT_SUCCESS;
@@ -125,11 +133,11 @@ int main( int argc, char *argv[] ) {
     else if( strcmp( command, "up" ) == 0 ) {
       // A up command is invalid if the column is more than five or less than zero.
       if ( row < 2 || row > 7 ) {
-        fail( "error" );
+        return commandError();
       }
       // A up command is invalid if the index to the up is not a peg or the index after that is not empty
       else if ( puzzleMemory->puzzleBoard[ row ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row - 1 ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row - 2 ][ column ] != '.' ) {
-        fail( "error" );
+        return commandError();
       }
       // Otherwise, perform the valid move and udpate the undo history with the successful move.
       else {
@@ -139,9 +147,7 @@ int main( int argc, char *argv[] ) {
         puzzleMemory->puzzleBoard[ row - 2 ][ column ] = 'o';
 
         // Update the undo history to include the most recent move.
-        strcpy( puzzleMemory->undoHistory[ 2 ], puzzleMemory->undoHistory[ 1 ] );
-        strcpy( puzzleMemory->undoHistory[ 1 ], puzzleMemory->undoHistory[ 0 ] );
-        strcpy( puzzleMemory->undoHistory[ 0 ], full_command );
+        recordMove( puzzleMemory, row, column, UP_DIR );
 
         // Send a success message.
         status = EXIT_SUCCESS;
@@ -150,11 +156,11 @@ int main( int argc, char *argv[] ) {
     else if( strcmp( command, "down" ) == 0 ) {
       // A down command is invalid if the column is more than five or less than zero.
       if ( row > 5 || row < 0 ) {
-        fail( "error" );
+        return commandError();
       }
       // A down command is invalid if the index to the down is not a peg or the index after that is not empty
       else if ( puzzleMemory->puzzleBoard[ row ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row + 1 ][ column ] != 'o' || puzzleMemory->puzzleBoard[ row + 2 ][ column ] != '.' ) {
-        fail( "error" );
+        return commandError();
       }
       // Otherwise, perform the valid move and udpate the undo history with the successful move.
       else {
@@ -164,9 +170,7 @@ int main( int argc, char *argv[] ) {
         puzzleMemory->puzzleBoard[ row + 2 ][ column ] = 'o';
 
         // Update the undo history to include the most recent move.
-        strcpy( puzzleMemory->undoHistory[ 2 ], puzzleMemory->undoHistory[ 1 ] );
-        strcpy( puzzleMemory->undoHistory[ 1 ], puzzleMemory->undoHistory[ 0 ] );
-        strcpy( puzzleMemory->undoHistory[ 0 ], full_command );
+        recordMove( puzzleMemory, row, column, DOWN_DIR );
 
         // Send a success message.
         status = EXIT_SUCCESS;
@@ -175,68 +179,57 @@ int main( int argc, char *argv[] ) {
   }
   else if ( strcmp( command, "undo" ) == 0 ) {
     // Send error if no move has been made or the undo history is empty.
-    if ( strlen( puzzleMemory->undoHistory[ 0 ] ) <= 1 )
-      fail( "error" );
+    if ( puzzleMemory->undoCount == 0 )
+      return commandError();
     // Otherwise undo the move and send a success message.
     else {
-      // Undo a right command.
-      if( puzzleMemory->undoHistory[ 0 ][ 0 ] == 'r' ) {
-        // Row of the peg to undo.
-        int row = puzzleMemory->undoHistory[ 0 ][ 6 ] - '0';
-        // Column of the peg to undo.
-        int column = puzzleMemory->undoHistory[ 0 ][ 8 ] - '0';
+      // Take the most recent move off the undo log.
+      puzzleMemory->undoNext = ( puzzleMemory->undoNext + UNDO_SIZE - 1 ) % UNDO_SIZE;
+      puzzleMemory->undoCount--;
+      unsigned char code = puzzleMemory->undoLog[ puzzleMemory->undoNext ];
 
+      // Row and column of the peg to undo.
+      int row = MOVE_ROW( code );
+      int column = MOVE_COL( code );
+
+      // Undo a right command.
+      if( MOVE_DIR( code ) == RIGHT_DIR ) {
         // Perform the opposite of the most recent move in the undo history.
         puzzleMemory->puzzleBoard[ row ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row ][ column + 1 ] = 'o';
         puzzleMemory->puzzleBoard[ row ][ column + 2 ] = '.';
       }
       // Undo a left command.
-      else if( puzzleMemory->undoHistory[ 0 ][ 0 ] == 'l' ) {
-        // Row of the peg to undo.
-        int row = puzzleMemory->undoHistory[ 0 ][ 5 ] - '0';
-        // Column of the peg to undo.
-        int column = puzzleMemory->undoHistory[ 0 ][ 7 ] - '0';
-
+      else if( MOVE_DIR( code ) == LEFT_DIR ) {
         // Perform the opposite of the most recent move in the undo history.
         puzzleMemory->puzzleBoard[ row ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row ][ column - 1 ] = 'o';
         puzzleMemory->puzzleBoard[ row ][ column - 2 ] = '.';
       }
       // Undo an up command.
-      else if( puzzleMemory->undoHistory[ 0 ][ 0 ] == 'u' ) {
-        // Row of the peg to undo.
-        int row = puzzleMemory->undoHistory[ 0 ][ 3 ] - '0';
-        // Column of the peg to undo.
-        int column = puzzleMemory->undoHistory[ 0 ][ 5 ] - '0';
-
+      else if( MOVE_DIR( code ) == UP_DIR ) {
         // Perform the opposite of the most recent move in the undo history.
         puzzleMemory->puzzleBoard[ row ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row - 1 ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row - 2 ][ column ] = '.';
       }
       // Undo a down command.
-      else if( puzzleMemory->undoHistory[ 0 ][ 0 ] == 'd' ) {
-        // Row of the peg to undo.
-        int row = puzzleMemory->undoHistory[ 0 ][ 5 ] - '0';
-        // Column of the peg to undo.
-        int column = puzzleMemory->undoHistory[ 0 ][ 7 ] - '0';
-
+      else if( MOVE_DIR( code ) == DOWN_DIR ) {
         // Perform the opposite of the most recent move in the undo history.
         puzzleMemory->puzzleBoard[ row ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row + 1 ][ column ] = 'o';
         puzzleMemory->puzzleBoard[ row + 2 ][ column ] = '.';
       }
 
-      // Update the undo history to not include the most recent move.
-      strcpy( puzzleMemory->undoHistory[ 0 ], puzzleMemory->undoHistory[ 1 ] );
-      strcpy( puzzleMemory->undoHistory[ 1 ], puzzleMemory->undoHistory[ 2 ] );
-      strcpy( puzzleMemory->undoHistory[ 2 ], "" );
-
       // Send a success message to the client.
       status = EXIT_SUCCESS;
     }
   }
+  // Give the session back to the table, so a reset can allocate it again.
+  else if ( strcmp( command, "end" ) == 0 ) {
+    puzzleMemory->used = 0;
+    status = EXIT_SUCCESS;
+  }
   // Perform the show command if this command is inputted.
   else if( strcmp( command, "show" ) == 0 ) {
     // String that the board message will be contained in.
@@ -254,22 +247,104 @@ int main( int argc, char *argv[] ) {
     // Print out the puzzle board.
     printf( "%s", boardMessage );
 
-    // Detatch from the shared memory.
-    shmdt( puzzleMemory );
-
     return status;
   }
   else {
     // If the command is not one of the allowed commands fail as error.
-    fail( "error" );
+    return commandError();
   }
 
   if( status == 0 ) {
     printf( "success\n" );
   }
 
+  return status;
+}
+
+// Read commands from fp, one per line in the same syntax as the command line, and run each one on
+// the game. Blank lines and lines starting with # are skipped. Returns failure if any command failed.
+int shell( Puzzle *puzzleMemory, FILE *fp )
+{
+  // Errors are answers to commands in the shell, so they go out in order with the rest.
+  errorStream = stdout;
+
+  // A script is read all at once, so its output can stay in the buffer. Anyone typing or
+  // piping commands in is waiting on each answer before sending the next command.
+  struct stat info;
+  bool script = fstat( fileno( fp ), &info ) == 0 && S_ISREG( info.st_mode );
+
+  int status = EXIT_SUCCESS;
+  char line[ 1024 ];
+  while ( true ) {
+    if ( !script )
+      fflush( stdout );
+    if ( !fgets( line, sizeof( line ), fp ) )
+      break;
+
+    // Split the line into words, after a stand-in for the program name. One word too many
+    // is kept, so runCommand sees there are too many.
+    char *args[ SHELL_ARGS + 2 ] = { "peg" };
+    int count = 1;
+    for ( char *word = strtok( line, " \t\r\n" ); word && count < SHELL_ARGS + 2; word = strtok( NULL, " \t\r\n" ) )
+      args[ count++ ] = word;
+
+    if ( count == 1 || args[ 1 ][ 0 ] == '#' )
+      continue;
+
+    if ( runCommand( puzzleMemory, count, args ) != EXIT_SUCCESS )
+      status = EXIT_FAILURE;
+  }
+
+  return status;
+}
+
+int main( int argc, char *argv[] ) {
+  /* Citing Help from the course website
+  * The code for opening and attaching to the shared memory is based on the shmWriter.c example program from the Processes section of the course website.
+  */
+  // Open the shared memory.
+  int shmid = shmget( ftok( "/mnt/ncsudrive/i/imbrain", 1 ), sizeof( SessionTable ), 0 );
+  if ( shmid == -1 )
+    fail( "Shared memory could not be attached " );
+
+  // Attach to the session table.
+  SessionTable *table = ( SessionTable * )shmat( shmid, 0, 0 );
+  // Fail if the memory cannot be pointed to
+  if ( table == ( SessionTable * )-1 )
+    fail( "Cannot map to shared memory" );
+
+  // A leading number picks the session to play in, otherwise it is session zero.
+  int session = 0;
+  if ( argc > 1 && strspn( argv[ 1 ], "0123456789" ) == strlen( argv[ 1 ] ) ) {
+    char *end;
+    long id = strtol( argv[ 1 ], &end, 10 );
+    if ( end == argv[ 1 ] || *end || id < 0 || id >= SESSIONS )
+      fail( "No such session" );
+    session = id;
+    argv++;
+    argc--;
+  }
+
+  // Fail if the session doesn't hold a game.
+  if ( !table->sessions[ session ].used )
+    fail( "No such session" );
+  Puzzle *puzzleMemory = &table->sessions[ session ];
+
+  // Run the commands from a script or standard input if this command is inputted.
+  int status;
+  if ( argc >= 2 && strcmp( argv[ 1 ], "shell" ) == 0 ) {
+    FILE *fp = stdin;
+    if ( argc > 3 || ( argc == 3 && !( fp = fopen( argv[ 2 ], "r" ) ) ) )
+      fail( "error" );
+    status = shell( puzzleMemory, fp );
+  }
+  // Otherwise run the one command on the command line.
+  else {
+    status = runCommand( puzzleMemory, argc, argv );
+  }
+
   // Detatch from the shared memory.
-  shmdt( puzzleMemory );
+  shmdt( table );
 
   return status;
 }
@@ -3,7 +3,9 @@
     @author Ian M Brain (imbrain)
     This program acts similarly as a server.
     Reads in puzzle board from a user provided file.
-    Interacts with peg.c through a struct within shared memory.
+    Interacts with peg.c through a struct within shared memory, one of a table of sessions that
+    each hold a game. The board is put in the session given on the command line, or in a free
+    one, and the session ID is printed for passing to peg.
     Citing Help from other Assignments
     The code for this program is based on server.c in homework 2 that I completed on 2/1/2024.
 */
@@ -27,7 +29,7 @@ static void fail( char const *message ) {
 
 // Print out a usage message and exit.
 static void usage() {
-  fprintf( stderr, "usage: reset <puzzle-file>\n" );
+  fprintf( stderr, "usage: reset <puzzle-file> [session]\n" );
   exit( 1 );
 }
 
@@ -35,10 +37,20 @@ int main( int argc, char *argv[] ) {
   // Eight by eight array representing the puzzle board.
   char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ] = { };
 
-  // The command line aruments are invalid if there are not two arguments.
-  if ( argc != 2 )
+  // The command line aruments are invalid if there are not two or three arguments.
+  if ( argc != 2 && argc != 3 )
     usage();
 
+  // Session to reset, or -1 to allocate a free one.
+  int session = -1;
+  if ( argc == 3 ) {
+    char *end;
+    long id = strtol( argv[ 2 ], &end, 10 );
+    if ( end == argv[ 2 ] || *end || id < 0 || id >= SESSIONS )
+      usage();
+    session = id;
+  }
+
   // Open the specified file.
   int fd = open( argv[ 1 ], O_RDONLY, 0600 );
 
@@ -115,25 +127,55 @@ int main( int argc, char *argv[] ) {
   /* Citing Help from the course website
   * The code for opening and attaching to the shared memory is based on the shmReader.c example program from the Processes section of the course website.
   */
-  // Create the memory shared between the server and client that is size of the puzzle struct.
-  int shmid = shmget( ftok( "/mnt/ncsudrive/i/imbrain", 1 ), sizeof( Puzzle ), 0666 | IPC_CREAT );
+  // Create the session table shared between the resets and pegs, if no reset has made it yet.
+  key_t key = ftok( "/mnt/ncsudrive/i/imbrain", 1 );
+  int shmid = shmget( key, sizeof( SessionTable ), 0666 | IPC_CREAT );
+
+  // A segment left by a build with a smaller table can't be reused, so replace it.
+  if ( shmid == -1 && errno == EINVAL ) {
+    shmctl( shmget( key, 0, 0 ), IPC_RMID, NULL );
+    shmid = shmget( key, sizeof( SessionTable ), 0666 | IPC_CREAT );
+  }
   // Fail as error if memory cannot be gotten.
   if ( shmid == -1 )
     fail( "Shared memory could not be created " );
 
-  // Attach to the shared memory and get the puzzle struct.
-  Puzzle *puzzleMemory = ( Puzzle * )shmat( shmid, 0, 0 );
+  // Attach to the shared memory and get the session table.
+  SessionTable *table = ( SessionTable * )shmat( shmid, 0, 0 );
   // Fail if the memory cannot be attached to.
-  if ( puzzleMemory == ( Puzzle * )-1 )
+  if ( table == ( SessionTable * )-1 )
     fail( "Cannot map Puzzle to shared memory" );
 
-  // Write the Puzzle struct into the shared memory.
-  for ( int i = 0; i < GRID_SIZE; i++ ) {
-    strcpy( puzzleMemory->puzzleBoard[ i ], puzzleBoard[ i ] );
+  // Take the session asked for, or the first free one.
+  if ( session < 0 ) {
+    for ( int i = 0; i < SESSIONS && session < 0; i++ ) {
+      unsigned int expected = 0;
+      if ( __atomic_compare_exchange_n( &table->sessions[ i ].used, &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+        session = i;
+    }
+
+    if ( session < 0 )
+      fail( "No free sessions" );
   }
+  else {
+    table->sessions[ session ].used = 1;
+  }
+  Puzzle *puzzleMemory = &table->sessions[ session ];
+
+  // Write the Puzzle struct into the shared memory. The rows end in a newline, not a null, so
+  // the board is copied whole.
+  memcpy( puzzleMemory->puzzleBoard, puzzleBoard, sizeof( puzzleBoard ) );
+
+  // Start with an empty undo log, so moves from the last game can't be undone on this one.
+  puzzleMemory->undoNext = 0;
+  puzzleMemory->undoCount = 0;
 
   // Detatch from the shared memory.
-  shmdt( puzzleMemory );
+  shmdt( table );
+
+  // Tell the user which session to give peg.
+  printf( "session %d\n", session );
 
   // Exit as success
   return EXIT_SUCCESS;
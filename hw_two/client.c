@@ -3,15 +3,28 @@
     @author Ian M Brain (imbrain)
     This program acts as a client for the server.c client.c application.
     Allows users to interact with the server to play the peg-jumping game.
-    Allows movement commands, undo commands, and show commands.
+    Allows movement commands, undo commands, and show commands, and can list the legal moves or
+    ask for a hint.
     Interacts with server.c through a message queue.
+    Requests are sent as BinaryRequest structs, or as text if the server is in text mode, which
+    the client tells from the size of the server queue's messages. Setting PEG_SOCKET sends them
+    over the server's UNIX socket instead.
+    Replies come back on a queue of the client's own, named after its process ID, so clients
+    running at the same time don't get each other's replies.
+    The shell command reads commands from a script file or standard input, one per line, and
+    keeps as many of them in the server's queue at once as it holds, each tagged with a request
+    ID, instead of waiting for every reply before sending the next request.
 */
 
 #include "common.h"
 #include <mqueue.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 // Print out an error message and exit.
 /** Citing Help from other Assignments
@@ -22,6 +35,247 @@ static void fail( char const *message ) {
   exit( 1 );
 }
 
+// Name of this client's reply queue.
+static char queueName[ QUEUE_NAME_LIMIT ];
+
+// True if the server takes BinaryRequest structs rather than text commands.
+static bool binaryMode;
+
+// Connection to the server's socket when PEG_SOCKET is set, or -1 to use the message queues.
+static int serverSocket = -1;
+
+// Most requests kept waiting for replies at once over the socket.
+#define SOCKET_WINDOW 64
+
+// Command name of each direction, indexed by RIGHT_DIR through UP_DIR.
+static char const *const dirNames[] = { "right", "down", "left", "up" };
+
+// Most words in a command, plus one so a command with too many can be caught.
+#define COMMAND_WORDS 4
+
+// Remove this client's reply queue when it exits.
+static void removeQueue() {
+    mq_unlink( queueName );
+}
+
+/**
+ * Print a reply from the server, with a newline unless it already ends with one, like a board does.
+ * @param reply reply to print
+*/
+static void printReply( char const *reply ) {
+    printf( "%s%s", reply, reply[ 0 ] && reply[ strlen( reply ) - 1 ] == '\n' ? "" : "\n" );
+}
+
+/**
+ * Fill in a binary request from the words of a command, like "right 3 1" or "show".
+ * @param count number of words
+ * @param words words of the command
+ * @param request request to fill in
+ * @return true if the command is valid
+*/
+static bool parseCommand( int count, char *words[], BinaryRequest *request ) {
+    memset( request, 0, sizeof( *request ) );
+    request->magic = BINARY_MAGIC;
+    request->pid = getpid();
+
+    for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+        if ( count >= 1 && strcmp( words[ 0 ], dirNames[ dir ] ) == 0 ) {
+            // The row and column must each be one digit on the board.
+            if ( count != 3 || strlen( words[ 1 ] ) != 1 || strlen( words[ 2 ] ) != 1 ||
+                 words[ 1 ][ 0 ] < '0' || words[ 1 ][ 0 ] >= '0' + GRID_SIZE ||
+                 words[ 2 ][ 0 ] < '0' || words[ 2 ][ 0 ] >= '0' + GRID_SIZE )
+                return false;
+
+            request->opcode = OP_MOVE;
+            request->row = words[ 1 ][ 0 ] - '0';
+            request->column = words[ 2 ][ 0 ] - '0';
+            request->dir = dir;
+            return true;
+        }
+    }
+
+    if ( count != 1 )
+        return false;
+    if ( strcmp( words[ 0 ], "undo" ) == 0 )
+        request->opcode = OP_UNDO;
+    else if ( strcmp( words[ 0 ], "show" ) == 0 )
+        request->opcode = OP_SHOW;
+    else if ( strcmp( words[ 0 ], "solvable" ) == 0 )
+        request->opcode = OP_SOLVABLE;
+    else if ( strcmp( words[ 0 ], "moves" ) == 0 )
+        request->opcode = OP_MOVES;
+    else if ( strcmp( words[ 0 ], "hint" ) == 0 )
+        request->opcode = OP_HINT;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Print a binary reply the way the text reply to the same request looks.
+ * @param reply reply to print
+*/
+static void printBinaryReply( BinaryReply const *reply ) {
+    // The board, for a show request.
+    if ( reply->opcode == OP_SHOW && reply->status == STATUS_SUCCESS ) {
+        for ( int i = 0; i < GRID_SIZE; i++ ) {
+            for ( int j = 0; j < GRID_SIZE; j++ ) {
+                uint64_t cell = 1ULL << ( i * GRID_SIZE + j );
+                putchar( reply->pegs & cell ? 'o' : reply->holes & cell ? '.' : '#' );
+            }
+            putchar( '\n' );
+        }
+        return;
+    }
+
+    // The legal moves on the board, for a moves request, one per line like the move commands.
+    if ( reply->opcode == OP_MOVES && reply->status == STATUS_SUCCESS ) {
+        bool any = false;
+        for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+            for ( uint64_t cells = movableCells( reply->pegs, reply->holes, dir ); cells; cells &= cells - 1 ) {
+                int cell = __builtin_ctzll( cells );
+                printf( "%s %d %d\n", dirNames[ dir ], cell / GRID_SIZE, cell % GRID_SIZE );
+                any = true;
+            }
+        }
+        if ( !any )
+            printf( "none\n" );
+        return;
+    }
+
+    // The move found for a hint request, or none if no move keeps the board solvable.
+    if ( reply->opcode == OP_HINT && ( reply->status == STATUS_SOLVABLE || reply->status == STATUS_UNSOLVABLE ) ) {
+        if ( reply->status == STATUS_SOLVABLE )
+            printf( "%s %d %d\n", dirNames[ MOVE_DIR( reply->move ) ], MOVE_ROW( reply->move ), MOVE_COL( reply->move ) );
+        else
+            printf( "none\n" );
+        return;
+    }
+
+    // Answers, in the order of the STATUS_ results.
+    char const *answers[] = { "success", "error", "solvable", "unsolvable", "unknown" };
+    printf( "%s\n", reply->status <= STATUS_UNKNOWN ? answers[ reply->status ] : "error" );
+}
+
+/**
+ * Send a binary request to the server, over the socket if there is one or the server queue if not.
+ * @param serverQueue queue of requests to the server
+ * @param request request to send
+ * @return true if it was sent
+*/
+static bool sendRequest( mqd_t serverQueue, BinaryRequest const *request ) {
+    if ( serverSocket != -1 )
+        return write( serverSocket, request, sizeof( *request ) ) == sizeof( *request );
+    return mq_send( serverQueue, ( char const * ) request, sizeof( *request ), 0 ) == 0;
+}
+
+/**
+ * Receive the next message from the server. Over the socket, this is every whole binary reply
+ * that has arrived, reading the rest of one that has only partly arrived.
+ * @param clientQueue queue of replies from the server
+ * @param buffer where to put the message, MESSAGE_LIMIT bytes long
+ * @return length of the message, or -1 if nothing could be received
+*/
+static int receiveMessage( mqd_t clientQueue, char *buffer ) {
+    if ( serverSocket == -1 )
+        return mq_receive( clientQueue, buffer, MESSAGE_LIMIT, NULL );
+
+    int limit = MESSAGE_LIMIT / sizeof( BinaryReply ) * sizeof( BinaryReply );
+    int len = read( serverSocket, buffer, limit );
+    while ( len > 0 && len % sizeof( BinaryReply ) != 0 ) {
+        int more = read( serverSocket, buffer + len, sizeof( BinaryReply ) - len % sizeof( BinaryReply ) );
+        if ( more <= 0 )
+            return -1;
+        len += more;
+    }
+    return len > 0 ? len : -1;
+}
+
+/**
+ * Send the commands read from fp to the server, keeping up to window of them in the queue at once,
+ * and print the replies in order. Blank lines and lines starting with # are skipped.
+ * @param serverQueue queue of requests to the server
+ * @param clientQueue queue of replies from the server
+ * @param fp where to read the commands from
+ * @param window most requests to have waiting for replies at once
+*/
+static void shell( mqd_t serverQueue, mqd_t clientQueue, FILE *fp, long window ) {
+    // Request ID of the next request to send, and how many are waiting for replies.
+    unsigned long nextId = 0;
+    long waiting = 0;
+    bool reading = true;
+
+    while ( reading || waiting > 0 ) {
+        // Send requests until the window is full or the commands run out.
+        while ( reading && waiting < window ) {
+            char line[ MESSAGE_LIMIT / 2 ];
+            if ( !fgets( line, sizeof( line ), fp ) ) {
+                reading = false;
+                break;
+            }
+
+            // Split the command into words.
+            char *words[ COMMAND_WORDS + 1 ];
+            int count = 0;
+            for ( char *word = strtok( line, " \t\r\n" ); word && count <= COMMAND_WORDS; word = strtok( NULL, " \t\r\n" ) )
+                words[ count++ ] = word;
+            if ( count == 0 || words[ 0 ][ 0 ] == '#' )
+                continue;
+
+            if ( binaryMode ) {
+                // Send a command that isn't valid with an operation the server answers with an error,
+                // so its reply still comes back in order.
+                BinaryRequest request;
+                if ( !parseCommand( count, words, &request ) )
+                    request.opcode = UINT8_MAX;
+                request.id = nextId++;
+                if ( !sendRequest( serverQueue, &request ) )
+                    fail( "Unable to send client message." );
+            }
+            else {
+                // Rebuild the command with single spaces, since the server reads it by position, and
+                // tag it with the reply queue and its ID.
+                char clientSend[ MESSAGE_LIMIT ];
+                int length = snprintf( clientSend, sizeof( clientSend ), "%s %lu", queueName, nextId++ );
+                for ( int i = 0; i < count && length < sizeof( clientSend ); i++ )
+                    length += snprintf( clientSend + length, sizeof( clientSend ) - length, " %s", words[ i ] );
+                if ( mq_send( serverQueue, clientSend, strlen( clientSend ), 0 ) != 0 )
+                    fail( "Unable to send client message." );
+            }
+            waiting++;
+        }
+
+        if ( waiting == 0 )
+            break;
+
+        // Receive the next batch of replies, each its request ID and reply ending in a null character.
+        char clientReceive[ MESSAGE_LIMIT + 1 ];
+        int len = receiveMessage( clientQueue, clientReceive );
+        if ( len <= 0 )
+            fail( "Unable to receive server message." );
+        clientReceive[ len ] = '\0';
+
+        // Binary replies are just one struct after another.
+        if ( binaryMode ) {
+            for ( int offset = 0; offset + sizeof( BinaryReply ) <= len; offset += sizeof( BinaryReply ) ) {
+                BinaryReply reply;
+                memcpy( &reply, clientReceive + offset, sizeof( reply ) );
+                printBinaryReply( &reply );
+                waiting--;
+            }
+        }
+
+        for ( char *record = clientReceive; !binaryMode && record < clientReceive + len; record += strlen( record ) + 1 ) {
+            char *reply = strchr( record, ' ' );
+            printReply( reply ? reply + 1 : "" );
+            waiting--;
+        }
+
+        // Let anyone waiting on the replies see them before blocking again.
+        fflush( stdout );
+    }
+}
+
 /**
  * Main functionality of the client.
  * Sends messages to the server through message queue.
@@ -40,25 +294,83 @@ int main( int argc, char *argv[] ) {
     attr.mq_maxmsg = 1;
     attr.mq_msgsize = MESSAGE_LIMIT;
 
-    // Client message to send to the server.
-    char clientSend[ 8 + 1 ] = "";
+    // Client message to send to the server, starting with the name of the reply queue.
+    char clientSend[ MESSAGE_LIMIT ] = "";
     // Client message received from the server.
     char clientReceive[ MESSAGE_LIMIT ] = "";
 
-    // Open the client and server queues.
-    mqd_t clientQueue = mq_open( CLIENT_QUEUE, O_RDONLY, 0600, &attr );
-    mqd_t serverQueue = mq_open( SERVER_QUEUE, O_WRONLY, 0600, &attr );
-    
-    // Print an error message and exit as failure if either message queue cannot be opened.
-    if ( clientQueue == -1 || serverQueue == -1 )
-        fail( "Can't open a message queue" );
+    // Requests waiting for replies at once in the shell, and the reply queue, which is left
+    // unused over the socket.
+    long window = SOCKET_WINDOW;
+    mqd_t serverQueue = -1;
+    mqd_t clientQueue = -1;
+
+    // Send binary requests over the server's socket if PEG_SOCKET is set to anything but "" or "0".
+    char const *socketOption = getenv( "PEG_SOCKET" );
+    if ( socketOption && socketOption[ 0 ] && strcmp( socketOption, "0" ) != 0 ) {
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+        strncpy( address.sun_path, SERVER_SOCKET, sizeof( address.sun_path ) - 1 );
+        serverSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( serverSocket == -1 || connect( serverSocket, ( struct sockaddr * ) &address, sizeof( address ) ) != 0 )
+            fail( "Can't connect to the server socket" );
+        binaryMode = true;
+    }
+    else {
+        // Open the server queue, and make a reply queue that can hold as many messages as it can.
+        serverQueue = mq_open( SERVER_QUEUE, O_WRONLY );
+        struct mq_attr serverAttr;
+        if ( serverQueue == -1 || mq_getattr( serverQueue, &serverAttr ) != 0 )
+            fail( "Can't open a message queue" );
+        attr.mq_maxmsg = serverAttr.mq_maxmsg;
+
+        // A server in binary mode takes requests exactly the size of one, and sends back a few replies at a time.
+        binaryMode = serverAttr.mq_msgsize == sizeof( BinaryRequest );
+        if ( binaryMode )
+            attr.mq_msgsize = BINARY_BATCH * sizeof( BinaryReply );
+
+        snprintf( queueName, sizeof( queueName ), "%s%d", CLIENT_QUEUE_PREFIX, getpid() );
+        mq_unlink( queueName );
+        clientQueue = mq_open( queueName, O_RDONLY | O_CREAT | O_EXCL, 0600, &attr );
+
+        // Print an error message and exit as failure if the reply queue cannot be made.
+        if ( clientQueue == -1 )
+            fail( "Can't open a message queue" );
+        atexit( removeQueue );
+        strcat( clientSend, queueName );
+        strcat( clientSend, " " );
+        window = serverAttr.mq_maxmsg;
+    }
 
     // Print error and exit if command line arguments are invalid.
     if ( argc < 2 || argc > 4 ) 
         fail( "error" );
 
+    // Send the commands from a script or standard input if this command is inputted.
+    if ( strcmp( argv[ 1 ], "shell" ) == 0 ) {
+        FILE *fp = stdin;
+        if ( argc > 3 || ( argc == 3 && !( fp = fopen( argv[ 2 ], "r" ) ) ) )
+            fail( "error" );
+
+        // Keep as many requests waiting as the server's queue holds.
+        shell( serverQueue, clientQueue, fp, window );
+    }
+    // Send any other command as a binary request if the server takes them.
+    else if ( binaryMode ) {
+        BinaryRequest request;
+        if ( !parseCommand( argc - 1, argv + 1, &request ) )
+            fail( "error" );
+        sendRequest( serverQueue, &request );
+
+        // Receive the reply from the server.
+        BinaryReply reply;
+        int len = receiveMessage( clientQueue, clientReceive );
+        if ( len < sizeof( reply ) )
+            fail( "Unable to receive server message." );
+        memcpy( &reply, clientReceive, sizeof( reply ) );
+        printBinaryReply( &reply );
+    }
     // Right, left, up, or down move command.
-    if ( strcmp( argv[ 1 ], "left" ) == 0 || strcmp( argv[ 1 ], "right" ) == 0 || strcmp( argv[ 1 ], "up" ) == 0 || strcmp( argv[ 1 ], "down" ) == 0 ) {
+    else if ( strcmp( argv[ 1 ], "left" ) == 0 || strcmp( argv[ 1 ], "right" ) == 0 || strcmp( argv[ 1 ], "up" ) == 0 || strcmp( argv[ 1 ], "down" ) == 0 ) {
         // Fail if there are an incorrect number of command line arguments.
         if ( argc != 4 ) 
             fail( "error" );
@@ -69,7 +381,6 @@ int main( int argc, char *argv[] ) {
         strcat( clientSend, argv[ 2 ] );
         strcat( clientSend, " " );
         strcat( clientSend, argv[ 3 ] );
-        strcat( clientSend, "\0" );
 
         // Send the client request to the server.
         mq_send( serverQueue, clientSend, strlen( clientSend ), 0 );
@@ -85,10 +396,14 @@ int main( int argc, char *argv[] ) {
 
         return EXIT_SUCCESS;
     }
-    // Perform the undo command that undoes the most recent move.
-    else if ( strcmp( argv[ 1 ], "undo" ) == 0 ) {
+    // Perform the undo command that undoes the most recent move, the solvable command that
+    // asks whether the board can still be solved, the moves command that lists the legal moves,
+    // or the hint command that asks for a move that keeps the board solvable.
+    else if ( strcmp( argv[ 1 ], "undo" ) == 0 || strcmp( argv[ 1 ], "solvable" ) == 0 ||
+              strcmp( argv[ 1 ], "moves" ) == 0 || strcmp( argv[ 1 ], "hint" ) == 0 ) {
         // Send the client request to the server.
-        mq_send( serverQueue, argv[ 1 ], strlen( argv[ 1 ] ), 0 );
+        strcat( clientSend, argv[ 1 ] );
+        mq_send( serverQueue, clientSend, strlen( clientSend ), 0 );
 
         // Receive the message from the server.
         int len = mq_receive( clientQueue, clientReceive, sizeof( clientReceive ), NULL );
@@ -96,13 +411,14 @@ int main( int argc, char *argv[] ) {
         if ( len <= 0 )
             fail( "Unable to receive server message." );
 
-        // Print the server success or error message.
-        printf( "%s\n", clientReceive );
+        // Print the server's reply, which is several lines for the moves command.
+        printReply( clientReceive );
     }
     // Perform the show command that prints out the puzzle board.
     else if ( strcmp( argv[ 1 ], "show" ) == 0 ) {
         // Send the client request to the server.
-        mq_send( serverQueue, argv[ 1 ], strlen( argv[ 1 ] ), 0 );
+        strcat( clientSend, argv[ 1 ] );
+        mq_send( serverQueue, clientSend, strlen( clientSend ), 0 );
 
         // Receive the message from the server.
         int len = mq_receive( clientQueue, clientReceive, sizeof( clientReceive ), NULL );
@@ -118,6 +434,9 @@ int main( int argc, char *argv[] ) {
         fail( "error" );
     }
 
-    // Close the client queue when after finishing
-    mq_close( clientQueue );
+    // Close the client queue or the socket when after finishing
+    if ( serverSocket != -1 )
+        close( serverSocket );
+    else
+        mq_close( clientQueue );
 }
@@ -1,18 +1,35 @@
+#include <stdint.h>
+
 // Name for the queue of messages going to the server.
 #define SERVER_QUEUE "/imbrain-server-queue"
 
-// Name for the queue of messages going to the current client.
+// Name for the queue of messages going to the current client, for clients that don't make their own.
 #define CLIENT_QUEUE "/imbrain-client-queue"
 
+// Start of the name of the reply queue each client makes for itself, followed by its process ID.
+#define CLIENT_QUEUE_PREFIX "/imbrain-client-"
+
+// Longest name of a client's reply queue, with its null terminator.
+#define QUEUE_NAME_LIMIT 64
+
+// Path of the UNIX socket the server also takes binary requests on.
+#define SERVER_SOCKET "/tmp/imbrain-peg-socket"
+
 // Maximum length for a message in the queue
 // (Long enough to hold any server request or response)
 #define MESSAGE_LIMIT 1024
 
+// Number of messages each queue holds when the server isn't given a depth. This is also the
+// most requests a client keeps in the queue at once, and the most the server handles per wakeup.
+#define QUEUE_DEPTH 10
+
 // Height and width of the playing area.
 #define GRID_SIZE 8
 
-// Length of the undo history.
+// Number of moves that can be undone. Can be raised with -DUNDO_SIZE=n.
+#ifndef UNDO_SIZE
 #define UNDO_SIZE 3
+#endif
 
 // Direction options for the move.  You're not required to use these
 // now, but you will need them for a later assignment.
@@ -20,3 +37,98 @@
 #define DOWN_DIR 1
 #define LEFT_DIR 2
 #define UP_DIR 3
+
+// Pack a move from ( r, c ) in direction dir into one byte, and get the parts back out.
+#define MOVE_CODE( r, c, dir ) ( ( unsigned char ) ( ( ( ( r ) * GRID_SIZE + ( c ) ) << 2 ) | ( dir ) ) )
+#define MOVE_ROW( code ) ( ( ( code ) >> 2 ) / GRID_SIZE )
+#define MOVE_COL( code ) ( ( ( code ) >> 2 ) % GRID_SIZE )
+#define MOVE_DIR( code ) ( ( code ) & 3 )
+
+// Cells in the first six columns, the only places a right move can start.
+#define LEFT_COLUMNS 0x3F3F3F3F3F3F3F3FULL
+
+// Cells in the last six columns, the only places a left move can start.
+#define RIGHT_COLUMNS 0xFCFCFCFCFCFCFCFCULL
+
+// Cells, one bit per cell at r * GRID_SIZE + c, from which a move in the given direction is legal.
+// The peg, the peg it jumps over and the hole it lands in are lined up by shifting the peg and
+// hole sets back by one and two steps, and horizontal moves must not wrap from one row to the next.
+static inline uint64_t movableCells( uint64_t pegs, uint64_t holes, int dir ) {
+  int step = dir == RIGHT_DIR ? 1 : dir == DOWN_DIR ? GRID_SIZE : dir == LEFT_DIR ? -1 : -GRID_SIZE;
+  uint64_t over = step > 0 ? pegs >> step : pegs << -step;
+  uint64_t land = step > 0 ? holes >> 2 * step : holes << -2 * step;
+  uint64_t cells = pegs & over & land;
+
+  if ( dir == RIGHT_DIR )
+    cells &= LEFT_COLUMNS;
+  else if ( dir == LEFT_DIR )
+    cells &= RIGHT_COLUMNS;
+  return cells;
+}
+
+// First byte of every binary request, so it can't be mistaken for a text one.
+#define BINARY_MAGIC 0xB1
+
+// Operations a binary request can ask for.
+#define OP_MOVE 0
+#define OP_UNDO 1
+#define OP_SHOW 2
+#define OP_SOLVABLE 3
+#define OP_MOVES 4
+#define OP_HINT 5
+
+// Results a binary reply can carry.
+#define STATUS_SUCCESS 0
+#define STATUS_ERROR 1
+#define STATUS_SOLVABLE 2
+#define STATUS_UNSOLVABLE 3
+#define STATUS_UNKNOWN 4
+
+// Most binary replies sent back in one message, which sets the size of a client's reply queue.
+#define BINARY_BATCH 16
+
+// Request sent to a server running in binary mode, which makes the server's queue this size.
+struct BinaryRequest {
+  /** Always BINARY_MAGIC. */
+  uint8_t magic;
+
+  /** One of the OP_ operations. */
+  uint8_t opcode;
+
+  /** Row and column of the peg to move, and the direction to move it, for OP_MOVE. */
+  uint8_t row;
+  uint8_t column;
+  uint8_t dir;
+
+  /** Unused, keeps the fields below aligned. */
+  uint8_t padding[ 3 ];
+
+  /** Request ID, sent back in the reply. */
+  uint32_t id;
+
+  /** Process ID of the client, whose reply queue the reply goes to. */
+  int32_t pid;
+} typedef BinaryRequest;
+
+// Reply to a binary request. Replies are sent back in batches of up to BINARY_BATCH in one message.
+// The legal moves asked for by OP_MOVES are the movableCells() of the board the reply carries.
+struct BinaryReply {
+  /** Request ID of the request this answers. */
+  uint32_t id;
+
+  /** Operation of the request this answers. */
+  uint8_t opcode;
+
+  /** One of the STATUS_ results. */
+  uint8_t status;
+
+  /** Move found by OP_HINT, packed with MOVE_CODE(), when the status is STATUS_SOLVABLE. */
+  uint8_t move;
+
+  /** Unused, keeps the board aligned. */
+  uint8_t padding;
+
+  /** Board after the request, as cells with a peg and empty holes at bit r * GRID_SIZE + c. */
+  uint64_t pegs;
+  uint64_t holes;
+} typedef BinaryReply;
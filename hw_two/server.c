@@ -5,6 +5,19 @@
     Allows users to play a peg-jumping puzzle.
     Reads in puzzle board from provided file and performs client.c operations on it.
     Interacts with client.c through a message queue.
+    Each client makes its own queue for replies, named after its process ID, and names it at the
+    start of every request, so several clients can play at once without getting each other's
+    replies. Requests that don't name a queue are answered on the shared client queue.
+    Requests and replies are small fixed-layout structs (see common.h), unless the server is
+    started in text mode for older clients, which send commands as text.
+    The same binary requests can also be sent over a UNIX stream socket, one struct after another,
+    with the replies written back on the connection. The server waits on the queue, the socket,
+    its connections and ctrl-c all at once with epoll.
+    Besides moves, undo, show and solvable, clients can ask for every legal move on the board, or
+    for a hint of a move that keeps the board solvable, found with the endgame database.
+    Clients can have many requests in the queue at once by tagging each one with a request ID.
+    Each time the server wakes up it handles every request already waiting, up to the depth of
+    the queue, and sends the replies to the tagged ones back together in one message.
 */
 
 #include "common.h"
@@ -18,6 +31,11 @@
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../hw_four/endgame.h"
 
 // Print out an error message and exit.
 static void fail( char const *message ) {
@@ -25,17 +43,559 @@ static void fail( char const *message ) {
   exit( 1 );
 }
 
-// Flag for telling the server to stop running because of a sigint.
-// This is safer than trying to print in the signal handler.
-static volatile int running = 1;
+// Endgame database, mapped the first time a client asks whether the board is solvable.
+static Endgame endgame;
 
-/** Citing Help from the Course Slides
- * The code for this signal handler function is based on handler in lecture three we discussed on 1/18/24.
- * Handler method for determining if ctrl-c is inputted.
- * @param sig signal integer
-*/
-void ctrlCHander( int sig ) {
-  running = 0;
+// True once the endgame database has been mapped.
+static bool endgameLoaded = false;
+
+// Pegs of the board read from the puzzle file, which the endgame database only answers for.
+static uint64_t startPegs;
+
+// Eight by eight array representing the puzzle board.
+static char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ];
+
+// Most recent moves packed with MOVE_CODE(), as a ring buffer that overwrites the oldest.
+static unsigned char undoLog[ UNDO_SIZE ];
+
+// Slot of the undo log the next move is written to, and how many moves can still be undone.
+static int undoNext = 0;
+static int undoCount = 0;
+
+// Most clients whose replies are held in one wakeup. Replies are sent early if more clients than this
+// have requests waiting.
+#define REPLY_DESTINATIONS 16
+
+// Replies to tagged requests from one client waiting to go out in one message.
+struct ReplyBatch {
+  /** Name of the client's reply queue, or "" for the shared CLIENT_QUEUE. */
+  char queue[ QUEUE_NAME_LIMIT ];
+
+  /** Replies, each "<id> <reply>" followed by a null character, or each a BinaryReply. */
+  char buffer[ MESSAGE_LIMIT ];
+
+  /** Number of bytes of the buffer in use. */
+  int length;
+} typedef ReplyBatch;
+
+// Replies waiting to be sent at the end of this wakeup, one batch for each client.
+static ReplyBatch batches[ REPLY_DESTINATIONS ];
+
+// Number of batches in use.
+static int batchCount = 0;
+
+// True if requests and replies are BinaryRequest and BinaryReply structs rather than text.
+static bool binaryMode = true;
+
+// Copy the puzzle board into text, with a newline after each row.
+static void boardText( char *boardMessage )
+{
+  // Copy the puzzle board into the message
+  strncpy( boardMessage, puzzleBoard[ 0 ], 9 );
+  boardMessage[ 9 ] = '\0';
+  for ( int i = 1; i < GRID_SIZE; i++ ) {
+    strncat( boardMessage, puzzleBoard[ i ], 9 );
+  }
+}
+
+// Rows and columns a peg moves through for each direction, indexed by RIGHT_DIR through UP_DIR.
+static int const rowStep[] = { 0, 1, 0, -1 };
+static int const columnStep[] = { 1, 0, -1, 0 };
+
+// Jump the peg at ( row, column ) over the peg next to it in direction dir, and update the undo
+// history with it. Returns false without changing the board if the move isn't legal.
+static bool makeMove( int row, int column, int dir )
+{
+  if ( dir < 0 || dir > UP_DIR )
+    return false;
+
+  // Row and column of the peg jumped over, and of the hole it lands in.
+  int overRow = row + rowStep[ dir ];
+  int overColumn = column + columnStep[ dir ];
+  int landRow = row + 2 * rowStep[ dir ];
+  int landColumn = column + 2 * columnStep[ dir ];
+
+  // A move is invalid if it starts or lands off the board.
+  if ( row < 0 || row >= GRID_SIZE || column < 0 || column >= GRID_SIZE ||
+       landRow < 0 || landRow >= GRID_SIZE || landColumn < 0 || landColumn >= GRID_SIZE )
+    return false;
+
+  // A move is invalid if the peg or the one it jumps is missing, or it doesn't land in a hole.
+  if ( puzzleBoard[ row ][ column ] != 'o' || puzzleBoard[ overRow ][ overColumn ] != 'o' ||
+       puzzleBoard[ landRow ][ landColumn ] != '.' )
+    return false;
+
+  // Perform the move.
+  puzzleBoard[ row ][ column ] = '.';
+  puzzleBoard[ overRow ][ overColumn ] = '.';
+  puzzleBoard[ landRow ][ landColumn ] = 'o';
+
+  // Update the undo history to include the most recent move.
+  undoLog[ undoNext ] = MOVE_CODE( row, column, dir );
+  undoNext = ( undoNext + 1 ) % UNDO_SIZE;
+  if ( undoCount < UNDO_SIZE )
+    undoCount++;
+  return true;
+}
+
+// Undo the most recent move in the undo history. Returns false if there isn't one.
+static bool undoMove()
+{
+  if ( undoCount == 0 )
+    return false;
+
+  // Take the most recent move off the undo log.
+  undoNext = ( undoNext + UNDO_SIZE - 1 ) % UNDO_SIZE;
+  undoCount--;
+  unsigned char code = undoLog[ undoNext ];
+
+  // Perform the opposite of the move.
+  int row = MOVE_ROW( code );
+  int column = MOVE_COL( code );
+  int dir = MOVE_DIR( code );
+  puzzleBoard[ row ][ column ] = 'o';
+  puzzleBoard[ row + rowStep[ dir ] ][ column + columnStep[ dir ] ] = 'o';
+  puzzleBoard[ row + 2 * rowStep[ dir ] ][ column + 2 * columnStep[ dir ] ] = '.';
+  return true;
+}
+
+// Build the peg and hole sets of the board, one bit per cell.
+static void boardBits( uint64_t *pegs, uint64_t *holes )
+{
+  *pegs = 0;
+  *holes = 0;
+  for ( int i = 0; i < GRID_SIZE; i++ ) {
+    for ( int j = 0; j < GRID_SIZE; j++ ) {
+      if ( puzzleBoard[ i ][ j ] == 'o' )
+        *pegs |= 1ULL << ( i * GRID_SIZE + j );
+      else if ( puzzleBoard[ i ][ j ] == '.' )
+        *holes |= 1ULL << ( i * GRID_SIZE + j );
+    }
+  }
+}
+
+// Look the board up in the endgame database, mapping it the first time it is needed. Returns one of
+// the ENDGAME_ answers, or false in loaded if there is no database.
+static int solvableAnswer( bool *loaded )
+{
+  if ( !endgameLoaded )
+    endgameLoaded = openEndgame( &endgame, endgamePath() );
+
+  *loaded = endgameLoaded;
+  if ( !endgameLoaded )
+    return ENDGAME_UNKNOWN;
+
+  uint64_t pegs, holes;
+  boardBits( &pegs, &holes );
+  return endgameSolvable( &endgame, startPegs, pegs, holes );
+}
+
+// Command name of each direction, indexed by RIGHT_DIR through UP_DIR.
+static char const *const dirNames[] = { "right", "down", "left", "up" };
+
+// Write every legal move on the board into the reply, one per line in the form of the move
+// commands, or "none" if there aren't any.
+static void listMoves( char *reply )
+{
+  uint64_t pegs, holes;
+  boardBits( &pegs, &holes );
+
+  reply[ 0 ] = '\0';
+  int length = 0;
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR; dir++ ) {
+    // Take the cells a move can start from one at a time, lowest first. No real board has
+    // enough moves to fill a message, but stop before overflowing it anyway.
+    for ( uint64_t cells = movableCells( pegs, holes, dir ); cells && length < MESSAGE_LIMIT - 16; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+      length += sprintf( reply + length, "%s %d %d\n", dirNames[ dir ], cell / GRID_SIZE, cell % GRID_SIZE );
+    }
+  }
+
+  if ( length == 0 )
+    strcpy( reply, "none" );
+}
+
+// Find a move that leaves the board solvable, from the endgame database of solved positions. Returns
+// ENDGAME_SOLVABLE with the move in code, ENDGAME_UNSOLVABLE if no move does, or ENDGAME_UNKNOWN if
+// the database doesn't cover the board. Sets loaded to false if there is no database.
+static int hintMove( bool *loaded, unsigned char *code )
+{
+  if ( !endgameLoaded )
+    endgameLoaded = openEndgame( &endgame, endgamePath() );
+
+  *loaded = endgameLoaded;
+  if ( !endgameLoaded )
+    return ENDGAME_UNKNOWN;
+
+  uint64_t pegs, holes;
+  boardBits( &pegs, &holes );
+
+  // Try each legal move on a copy of the board until one lands on a solvable position.
+  int answer = ENDGAME_UNSOLVABLE;
+  for ( int dir = RIGHT_DIR; dir <= UP_DIR && answer != ENDGAME_SOLVABLE; dir++ ) {
+    for ( uint64_t cells = movableCells( pegs, holes, dir ); cells && answer != ENDGAME_SOLVABLE; cells &= cells - 1 ) {
+      int cell = __builtin_ctzll( cells );
+      int row = cell / GRID_SIZE;
+      int column = cell % GRID_SIZE;
+      uint64_t moved = ( 1ULL << cell ) | ( 1ULL << ( ( row + rowStep[ dir ] ) * GRID_SIZE + column + columnStep[ dir ] ) ) |
+                       ( 1ULL << ( ( row + 2 * rowStep[ dir ] ) * GRID_SIZE + column + 2 * columnStep[ dir ] ) );
+
+      int result = endgameSolvable( &endgame, startPegs, pegs ^ moved, holes ^ moved );
+      if ( result == ENDGAME_SOLVABLE ) {
+        answer = ENDGAME_SOLVABLE;
+        *code = MOVE_CODE( row, column, dir );
+      }
+      else if ( result == ENDGAME_UNKNOWN ) {
+        answer = ENDGAME_UNKNOWN;
+      }
+    }
+  }
+
+  return answer;
+}
+
+// Run one request from a client on the board, and fill in the reply to send back.
+static void runRequest( char const *request, char *reply )
+{
+  // Perform the right, left, up or down move if one of those commands is inputted. The row and
+  // column are the digits after the command.
+  if( request[ 0 ] == 'r' ) {
+    strcpy( reply, makeMove( request[ 6 ] - '0', request[ 8 ] - '0', RIGHT_DIR ) ? "success" : "error" );
+  }
+  else if( request[ 0 ] == 'l' ) {
+    strcpy( reply, makeMove( request[ 5 ] - '0', request[ 7 ] - '0', LEFT_DIR ) ? "success" : "error" );
+  }
+  else if( request[ 0 ] == 'u' && request[ 1 ] == 'p') {
+    strcpy( reply, makeMove( request[ 3 ] - '0', request[ 5 ] - '0', UP_DIR ) ? "success" : "error" );
+  }
+  else if( request[ 0 ] == 'd' ) {
+    strcpy( reply, makeMove( request[ 5 ] - '0', request[ 7 ] - '0', DOWN_DIR ) ? "success" : "error" );
+  }
+  // Perform the undo move if the the undo command is inputted.
+  else if( request[ 0 ] == 'u' && request[ 1 ] == 'n') {
+    strcpy( reply, undoMove() ? "success" : "error" );
+  }
+  // Perform the solvable command if this command is inputted.
+  else if( strcmp( request, "solvable" ) == 0 ) {
+    bool loaded;
+    int answer = solvableAnswer( &loaded );
+    char const *answerMessage = !loaded ? "error" : answer == ENDGAME_SOLVABLE ? "solvable" : answer == ENDGAME_UNSOLVABLE ? "unsolvable" : "unknown";
+    strcpy( reply, answerMessage );
+  }
+  // Perform the show command if this command is inputted.
+  else if( strcmp( request, "show" ) == 0 ) {
+    // Copy the puzzle board into the reply.
+    boardText( reply );
+  }
+  // List the legal moves if the moves command is inputted.
+  else if( strcmp( request, "moves" ) == 0 ) {
+    listMoves( reply );
+  }
+  // Suggest a move that keeps the board solvable if the hint command is inputted.
+  else if( strcmp( request, "hint" ) == 0 ) {
+    bool loaded;
+    unsigned char code;
+    int answer = hintMove( &loaded, &code );
+    if ( !loaded )
+      strcpy( reply, "error" );
+    else if ( answer == ENDGAME_SOLVABLE )
+      sprintf( reply, "%s %d %d", dirNames[ MOVE_DIR( code ) ], MOVE_ROW( code ), MOVE_COL( code ) );
+    else
+      strcpy( reply, answer == ENDGAME_UNSOLVABLE ? "none" : "unknown" );
+  }
+  else {
+    // whatever error is... NOT RIGHT _-----_______------______----- 
+    strcpy( reply, "error" );
+  }
+}
+
+// Run one binary request on the board, and fill in the reply to send back. Every reply carries the
+// board as it is after the request.
+static void runBinaryRequest( BinaryRequest const *request, BinaryReply *reply )
+{
+  bool loaded;
+  int answer;
+  unsigned char code = 0;
+
+  reply->id = request->id;
+  reply->opcode = request->opcode;
+  switch ( request->opcode ) {
+    case OP_MOVE:
+      reply->status = makeMove( request->row, request->column, request->dir ) ? STATUS_SUCCESS : STATUS_ERROR;
+      break;
+    case OP_UNDO:
+      reply->status = undoMove() ? STATUS_SUCCESS : STATUS_ERROR;
+      break;
+    case OP_SHOW:
+    case OP_MOVES:
+      reply->status = STATUS_SUCCESS;
+      break;
+    case OP_HINT:
+      answer = hintMove( &loaded, &code );
+      reply->status = !loaded ? STATUS_ERROR : answer == ENDGAME_SOLVABLE ? STATUS_SOLVABLE :
+                      answer == ENDGAME_UNSOLVABLE ? STATUS_UNSOLVABLE : STATUS_UNKNOWN;
+      reply->move = code;
+      break;
+    case OP_SOLVABLE:
+      answer = solvableAnswer( &loaded );
+      reply->status = !loaded ? STATUS_ERROR : answer == ENDGAME_SOLVABLE ? STATUS_SOLVABLE :
+                      answer == ENDGAME_UNSOLVABLE ? STATUS_UNSOLVABLE : STATUS_UNKNOWN;
+      break;
+    default:
+      reply->status = STATUS_ERROR;
+      break;
+  }
+  boardBits( &reply->pegs, &reply->holes );
+}
+
+// Send one message to a client. Replies for the shared CLIENT_QUEUE wait for room as before, but
+// a client's own queue is opened without blocking, so a client that stopped reading or exited just
+// loses its replies instead of holding up every other client.
+static void sendReply( mqd_t sharedQueue, char const *queue, char const *message, int length )
+{
+  if ( !queue[ 0 ] ) {
+    mq_send( sharedQueue, message, length, 0 );
+    return;
+  }
+
+  mqd_t clientQueue = mq_open( queue, O_WRONLY | O_NONBLOCK );
+  if ( clientQueue == -1 )
+    return;
+  mq_send( clientQueue, message, length, 0 );
+  mq_close( clientQueue );
+}
+
+// Send the replies waiting in the batch as one message.
+static void flushReplies( mqd_t sharedQueue, ReplyBatch *batch )
+{
+  if ( batch->length > 0 )
+    sendReply( sharedQueue, batch->queue, batch->buffer, batch->length );
+  batch->length = 0;
+}
+
+// Send the replies waiting for every client.
+static void flushAllReplies( mqd_t sharedQueue )
+{
+  for ( int i = 0; i < batchCount; i++ )
+    flushReplies( sharedQueue, &batches[ i ] );
+  batchCount = 0;
+}
+
+// Find the batch of replies going to a reply queue, starting a new one if there isn't one yet.
+static ReplyBatch *findBatch( mqd_t sharedQueue, char const *queue )
+{
+  for ( int i = 0; i < batchCount; i++ )
+    if ( strcmp( batches[ i ].queue, queue ) == 0 )
+      return &batches[ i ];
+
+  // Make room by sending everything held so far if every batch is in use.
+  if ( batchCount == REPLY_DESTINATIONS )
+    flushAllReplies( sharedQueue );
+
+  ReplyBatch *batch = &batches[ batchCount++ ];
+  strcpy( batch->queue, queue );
+  batch->length = 0;
+  return batch;
+}
+
+// Add a reply to the batch for its client, sending the batch first if the reply won't fit in it.
+static void addReply( mqd_t sharedQueue, ReplyBatch *batch, void const *record, int length )
+{
+  int limit = binaryMode ? BINARY_BATCH * sizeof( BinaryReply ) : MESSAGE_LIMIT;
+  if ( batch->length + length > limit )
+    flushReplies( sharedQueue, batch );
+
+  memcpy( batch->buffer + batch->length, record, length );
+  batch->length += length;
+}
+
+// Run one binary request, and batch its reply for the client that sent it. Requests that are the
+// wrong size or don't come from a client with a reply queue are dropped.
+static void handleBinary( mqd_t sharedQueue, char const *message, int len )
+{
+  BinaryRequest request;
+  if ( len != sizeof( request ) )
+    return;
+  memcpy( &request, message, sizeof( request ) );
+  if ( request.magic != BINARY_MAGIC || request.pid <= 0 )
+    return;
+
+  char queue[ QUEUE_NAME_LIMIT ];
+  snprintf( queue, sizeof( queue ), "%s%d", CLIENT_QUEUE_PREFIX, request.pid );
+
+  BinaryReply reply = { 0 };
+  runBinaryRequest( &request, &reply );
+  addReply( sharedQueue, findBatch( sharedQueue, queue ), &reply, sizeof( reply ) );
+}
+
+// Run one message from a client. A client with its own reply queue starts each message with the
+// queue's name, and a message without one is from an older client, whose replies go to CLIENT_QUEUE.
+// After that, a message starting with a number is a tagged request, whose reply goes into the
+// client's batch with the same number in front of it. Anything else is an untagged request, which
+// gets its reply on its own.
+static void handleMessage( mqd_t sharedQueue, char *message, int len )
+{
+  if ( binaryMode ) {
+    handleBinary( sharedQueue, message, len );
+    return;
+  }
+
+  char reply[ MESSAGE_LIMIT ] = "";
+  message[ len ] = '\0';
+
+  // Split off the reply queue. Only client queues are accepted, so a request can't have the server
+  // write into some other queue.
+  char const *queue = "";
+  if ( message[ 0 ] == '/' ) {
+    char *space = strchr( message, ' ' );
+    if ( !space )
+      return;
+    *space = '\0';
+    queue = message;
+    message = space + 1;
+
+    if ( strncmp( queue, CLIENT_QUEUE_PREFIX, strlen( CLIENT_QUEUE_PREFIX ) ) != 0 ||
+         strlen( queue ) >= QUEUE_NAME_LIMIT )
+      return;
+  }
+  ReplyBatch *batch = findBatch( sharedQueue, queue );
+
+  if ( message[ 0 ] < '0' || message[ 0 ] > '9' ) {
+    // Send what is already batched first, so replies go out in the order requests came in.
+    runRequest( message, reply );
+    flushReplies( sharedQueue, batch );
+    sendReply( sharedQueue, queue, reply, strlen( reply ) );
+    return;
+  }
+
+  // Split off the request ID.
+  char *command;
+  unsigned long id = strtoul( message, &command, 10 );
+  if ( *command == ' ' )
+    command++;
+  runRequest( command, reply );
+
+  char record[ MESSAGE_LIMIT ];
+  int length = snprintf( record, sizeof( record ), "%lu %s", id, reply ) + 1;
+  if ( length > sizeof( record ) )
+    length = sizeof( record );
+  addReply( sharedQueue, batch, record, length );
+}
+
+// Most clients connected to the socket at once.
+#define MAX_CONNECTIONS 64
+
+// Most events handled each time the server wakes up.
+#define MAX_EVENTS 16
+
+// One client connected to the server's socket.
+struct Connection {
+  /** Descriptor of the connection, or -1 if this slot is free. */
+  int fd;
+
+  /** Start of a request that hasn't all arrived yet. */
+  char partial[ sizeof( BinaryRequest ) ];
+
+  /** Number of bytes of the partial request that have arrived. */
+  int length;
+} typedef Connection;
+
+// Clients connected to the socket.
+static Connection connections[ MAX_CONNECTIONS ];
+
+// Have epoll report when a descriptor is ready to read.
+static void watch( int epollFd, int fd )
+{
+  struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+  if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, fd, &event ) != 0 )
+    fail( "Can't wait on the server's descriptors" );
+}
+
+// Run the requests waiting in the server queue, up to the depth of the queue, and send their replies.
+// The queue is non-blocking, so this stops early once it is empty.
+static void serveQueue( mqd_t serverQueue, mqd_t clientQueue, int depth )
+{
+  // Message received from the client.
+  char serverReceive[ MESSAGE_LIMIT + 1 ];
+
+  for ( int handled = 0; handled < depth; handled++ ) {
+    int len = mq_receive( serverQueue, serverReceive, MESSAGE_LIMIT, NULL );
+    if ( len < 0 )
+      break;
+    handleMessage( clientQueue, serverReceive, len );
+  }
+
+  flushAllReplies( clientQueue );
+}
+
+// Accept every client waiting to connect to the socket. Clients past MAX_CONNECTIONS are hung up on.
+static void acceptConnections( int epollFd, int listenFd )
+{
+  int fd;
+  while ( ( fd = accept( listenFd, NULL, NULL ) ) != -1 ) {
+    fcntl( fd, F_SETFL, O_NONBLOCK );
+
+    Connection *connection = NULL;
+    for ( int i = 0; i < MAX_CONNECTIONS && !connection; i++ )
+      if ( connections[ i ].fd == -1 )
+        connection = &connections[ i ];
+
+    if ( !connection ) {
+      close( fd );
+      continue;
+    }
+
+    connection->fd = fd;
+    connection->length = 0;
+    watch( epollFd, fd );
+  }
+}
+
+// Hang up on a socket client.
+static void closeConnection( int epollFd, Connection *connection )
+{
+  epoll_ctl( epollFd, EPOLL_CTL_DEL, connection->fd, NULL );
+  close( connection->fd );
+  connection->fd = -1;
+}
+
+// Run the requests a socket client has sent, and write all their replies back at once. A request
+// split across reads is kept until the rest of it arrives. The client is hung up on if it closes
+// its end, sends something that isn't a request, or doesn't read its replies fast enough to take
+// them in one write.
+static void serveConnection( int epollFd, Connection *connection )
+{
+  char buffer[ BINARY_BATCH * sizeof( BinaryRequest ) ];
+  memcpy( buffer, connection->partial, connection->length );
+  ssize_t got = read( connection->fd, buffer + connection->length, sizeof( buffer ) - connection->length );
+  if ( got < 0 && ( errno == EAGAIN || errno == EINTR ) )
+    return;
+  if ( got <= 0 ) {
+    closeConnection( epollFd, connection );
+    return;
+  }
+
+  BinaryReply replies[ BINARY_BATCH ] = { { 0 } };
+  int count = 0;
+  int total = connection->length + got;
+  int offset = 0;
+  for ( ; offset + sizeof( BinaryRequest ) <= total; offset += sizeof( BinaryRequest ) ) {
+    BinaryRequest request;
+    memcpy( &request, buffer + offset, sizeof( request ) );
+    if ( request.magic != BINARY_MAGIC ) {
+      closeConnection( epollFd, connection );
+      return;
+    }
+    runBinaryRequest( &request, &replies[ count++ ] );
+  }
+
+  // Keep the start of the next request.
+  connection->length = total - offset;
+  memcpy( connection->partial, buffer + offset, connection->length );
+
+  int size = count * sizeof( BinaryReply );
+  if ( count > 0 && write( connection->fd, replies, size ) != size )
+    closeConnection( epollFd, connection );
 }
 
 /**
@@ -52,15 +612,20 @@ int main( int argc, char *argv[] ) {
   mq_unlink( SERVER_QUEUE );
   mq_unlink( CLIENT_QUEUE );
 
-  // Eight by eight array representing the puzzle board.
-  char puzzleBoard[ GRID_SIZE ][ GRID_SIZE + 1 ];
+  // The command line aruments are invalid if there are not two to four arguments.
+  if ( argc < 2 || argc > 4 )
+    fail( "usage: server <puzzle-file> [queue-depth] [binary|text]" );
 
-  // Array containing most recent three moves.
-  char undoHistory[ UNDO_SIZE ][ MESSAGE_LIMIT ] = { };
+  // Number of messages each queue holds, and the most requests handled in one wakeup.
+  int depth = argc >= 3 ? atoi( argv[ 2 ] ) : QUEUE_DEPTH;
+  if ( depth <= 0 )
+    fail( "usage: server <puzzle-file> [queue-depth] [binary|text]" );
 
-  // The command line aruments are invalid if there are not two arguments.
-  if ( argc != 2 )
-    fail( "usage: server <puzzle-file>" );
+  // Use text messages if asked to, for older clients.
+  if ( argc == 4 && strcmp( argv[ 3 ], "text" ) == 0 )
+    binaryMode = false;
+  else if ( argc == 4 && strcmp( argv[ 3 ], "binary" ) != 0 )
+    fail( "usage: server <puzzle-file> [queue-depth] [binary|text]" );
 
   // Open the specified file.
   int fd = open( argv[ 1 ], O_RDONLY, 0600 );
@@ -74,7 +639,7 @@ int main( int argc, char *argv[] ) {
     fail( errorMessage );
   }
 
-  char readLine[ GRID_SIZE ] = "";
+  char readLine[ GRID_SIZE + 1 ] = "";
 
   int charsRead = 0;
 
@@ -130,284 +695,105 @@ int main( int argc, char *argv[] ) {
     fail( errorMessage );
   }
 
+  // Remember the starting pegs for endgame database lookups.
+  uint64_t startHoles;
+  boardBits( &startPegs, &startHoles );
+
   // Prepare structure indicating maximum queue and message sizes.
   struct mq_attr attr;
   attr.mq_flags = 0;
-  attr.mq_maxmsg = 1;
-  attr.mq_msgsize = MESSAGE_LIMIT;
+  attr.mq_maxmsg = depth;
+  attr.mq_msgsize = binaryMode ? sizeof( BinaryRequest ) : MESSAGE_LIMIT;
 
-  // Make both the server and client message queues.
-  mqd_t serverQueue = mq_open( SERVER_QUEUE, O_RDONLY | O_CREAT, 0600, &attr );
-  mqd_t clientQueue = mq_open( CLIENT_QUEUE, O_WRONLY | O_CREAT, 0600, &attr );
-  if ( serverQueue == -1 || clientQueue == -1 )
+  // Make the server queue, and the shared client queue for text clients without their own. The
+  // size of the server queue's messages tells clients which mode the server is in.
+  mqd_t serverQueue = mq_open( SERVER_QUEUE, O_RDONLY | O_CREAT | O_NONBLOCK, 0600, &attr );
+  attr.mq_msgsize = MESSAGE_LIMIT;
+  mqd_t clientQueue = binaryMode ? -1 : mq_open( CLIENT_QUEUE, O_WRONLY | O_CREAT, 0600, &attr );
+  if ( serverQueue == -1 || ( !binaryMode && clientQueue == -1 ) )
     fail( "Can't create the needed message queues" );
 
-  /** Citing Help from the Course Slides
-   * The code for this signal handler operation is based on handler in lecture three we discussed on 1/18/24.
-   * Set up the signal hander and link it with the associated method.
-  */
-  struct sigaction act;
-
-  act.sa_handler = ctrlCHander;
-  sigemptyset( &( act.sa_mask ) );
-  act.sa_flags = 0;
-
-  // Repeatedly read and process client messages.
+  // Take ctrl-c through a descriptor instead of a handler, so it is waited on with everything else.
+  sigset_t signals;
+  sigemptyset( &signals );
+  sigaddset( &signals, SIGINT );
+  sigprocmask( SIG_BLOCK, &signals, NULL );
+  int signalFd = signalfd( -1, &signals, SFD_CLOEXEC );
+  if ( signalFd == -1 )
+    fail( "Can't wait for ctrl-c" );
+
+  // Listen on the socket, replacing any left behind by a server that didn't exit cleanly.
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  strncpy( address.sun_path, SERVER_SOCKET, sizeof( address.sun_path ) - 1 );
+  unlink( SERVER_SOCKET );
+  int listenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if ( listenFd == -1 || bind( listenFd, ( struct sockaddr * ) &address, sizeof( address ) ) != 0 ||
+       listen( listenFd, SOMAXCONN ) != 0 )
+    fail( "Can't create the server socket" );
+
+  for ( int i = 0; i < MAX_CONNECTIONS; i++ )
+    connections[ i ].fd = -1;
+
+  // On Linux a message queue descriptor is a file descriptor, so epoll can wait on it too.
+  int epollFd = epoll_create1( EPOLL_CLOEXEC );
+  if ( epollFd == -1 )
+    fail( "Can't wait on the server's descriptors" );
+  watch( epollFd, serverQueue );
+  watch( epollFd, listenFd );
+  watch( epollFd, signalFd );
+
+  // Repeatedly wait for requests, new clients or ctrl-c, and handle whichever are ready.
+  bool running = true;
   while ( running ) {
-    // Signal action handler for the ctrl-c signal.
-    sigaction( SIGINT, &act, 0 );
-
-    // Message received from the client.
-    char serverReceive[ MESSAGE_LIMIT ] = "";
-    // Error message to send when there is an invalid command.
-    char errorMessage[ 6 ] = "";
-    strcpy( errorMessage, "error" );
-    // Success message to send when there is a valid command.
-    char successMessage[ 8 ] = "";
-    strcpy( successMessage, "success" );
-
-    // Receive the message sent from the client.
-    int len = mq_receive( serverQueue, serverReceive, sizeof( serverReceive ), NULL );
-
-    // Print the puzzle board and exit the server if the user passes ctrl-c.
-    if ( len == -1 && errno == EINTR  ) {
-      // String that the board message will be contained in.
-      char boardMessage[ 73 ] = "";
-
-      // Copy the puzzle board into the message
-      strncpy( boardMessage, puzzleBoard[ 0 ], 9 );
-      for ( int i = 1; i < GRID_SIZE; i++ ) {
-        strncat( boardMessage, puzzleBoard[ i ], 9 );
-      }
-
-      // Ensure null terminator is at the end of the board message.
-      strcat( boardMessage, "\0" );
-
-      // Print out the puzzle board and exit the program.
-      fprintf( stderr, "\n%s", boardMessage );
-      exit( 0 );
-    }
-
-    // Fail and return error message if the server did not receive a message.
-    if ( len < 0 ) {
+    struct epoll_event events[ MAX_EVENTS ];
+    int count = epoll_wait( epollFd, events, MAX_EVENTS, -1 );
+    if ( count < 0 && errno == EINTR )
+      continue;
+    if ( count < 0 )
       fail( "Unable to receive client message." );
-    }
 
-    // Perform the right move if the the right command is inputted.
-    if( serverReceive[ 0 ] == 'r' ) {
-      // Row of the peg to move.
-      int row = serverReceive[ 6 ] - '0';
-      // Column of the peg to move.
-      int column = serverReceive[ 8 ] - '0';
-
-      // A right command is invalid if the column is more than five or less than zero.
-      if ( column > 5 || column < 0 ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      }
-      // A right command is invalid if the index to the right is not a peg or the index after that is not empty
-      else if ( puzzleBoard[ row ][ column ] != 'o' || puzzleBoard[ row ][ column + 1 ] != 'o' || puzzleBoard[ row ][ column + 2 ] != '.' ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      }
-      // Otherwise, perform the valid move and udpate the undo history with the successful move.
-      else {
-        // Perform the move.
-        puzzleBoard[ row ][ column ] = '.';
-        puzzleBoard[ row ][ column + 1 ] = '.';
-        puzzleBoard[ row ][ column + 2 ] = 'o';
-
-        // Update the undo history to include the most recent move.
-        strcpy( undoHistory[ 2 ], undoHistory[ 1 ] );
-        strcpy( undoHistory[ 1 ], undoHistory[ 0 ] );
-        strcpy( undoHistory[ 0 ], serverReceive );
-
-        // Send a success message.
-        mq_send( clientQueue, successMessage, strlen( successMessage ), 0 );
-      }
-    }
-    // Perform the left move if the the left command is inputted.
-    else if( serverReceive[ 0 ] == 'l' ) {
-      // Row of the peg to move.
-      int row = serverReceive[ 5 ] - '0';
-      // Column of the peg to move.
-      int column = serverReceive[ 7 ] - '0';
-
-      // Left command cannot is invalid if the column is less than two or more than seven.
-      if ( column < 2 || column > 7 ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
+    for ( int i = 0; i < count; i++ ) {
+      int fd = events[ i ].data.fd;
+      if ( fd == signalFd ) {
+        struct signalfd_siginfo info;
+        if ( read( signalFd, &info, sizeof( info ) ) == sizeof( info ) )
+          running = false;
       }
-      // Left command is invalid if the index to the left is not a peg or the index after that is not empty
-      else if ( puzzleBoard[ row ][ column ] != 'o' || puzzleBoard[ row ][ column - 1 ] != 'o' || puzzleBoard[ row ][ column - 2 ] != '.' ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
+      else if ( fd == serverQueue ) {
+        serveQueue( serverQueue, clientQueue, depth );
       }
-      // Otherwise, perform the valid move and udpate the undo history with the successful move.
-      else {
-        // Perform the move.
-        puzzleBoard[ row ][ column ] = '.';
-        puzzleBoard[ row ][ column - 1 ] = '.';
-        puzzleBoard[ row ][ column - 2 ] = 'o';
-
-        // Update the undo history to include the most recent move.
-        strcpy( undoHistory[ 2 ], undoHistory[ 1 ] );
-        strcpy( undoHistory[ 1 ], undoHistory[ 0 ] );
-        strcpy( undoHistory[ 0 ], serverReceive );
-
-        // Send a success message.
-        mq_send( clientQueue, successMessage, strlen( successMessage ), 0 );
-      }
-    }
-    // Perform the up move if the the up command is inputted.
-    else if( serverReceive[ 0 ] == 'u' && serverReceive[ 1 ] == 'p') {
-      // Row of the peg to move.
-      int row = serverReceive[ 3 ] - '0';
-      // Column of the peg to move.
-      int column = serverReceive[ 5 ] - '0';
-
-      // Up command is invalid if the row is less than two or more than seven.
-      if ( row < 2 || row > 7 ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
+      else if ( fd == listenFd ) {
+        acceptConnections( epollFd, listenFd );
       }
-      // Up command is invalid if the index above the peg is not a peg or the index after that is not empty
-      else if ( puzzleBoard[ row ][ column ] != 'o' || puzzleBoard[ row - 1 ][ column ] != 'o' || puzzleBoard[ row - 2 ][ column ] != '.' ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      }
-      // Otherwise, perform the valid move and udpate the undo history with the successful move.
       else {
-        // Perform the move.
-        puzzleBoard[ row ][ column ] = '.';
-        puzzleBoard[ row - 1 ][ column ] = '.';
-        puzzleBoard[ row - 2 ][ column ] = 'o';
-
-        // Update the undo history to include the most recent move.
-        strcpy( undoHistory[ 2 ], undoHistory[ 1 ] );
-        strcpy( undoHistory[ 1 ], undoHistory[ 0 ] );
-        strcpy( undoHistory[ 0 ], serverReceive );
-
-        // Send a success message.
-        mq_send( clientQueue, successMessage, strlen( successMessage ), 0 );
+        for ( int j = 0; j < MAX_CONNECTIONS; j++ )
+          if ( connections[ j ].fd == fd )
+            serveConnection( epollFd, &connections[ j ] );
       }
     }
-    // Perform the down move if the the up command is inputted.
-    else if( serverReceive[ 0 ] == 'd' ) {
-      // Row of the peg to move.
-      int row = serverReceive[ 5 ] - '0';
-      // Column of the peg to move.
-      int column = serverReceive[ 7 ] - '0';
-
-      // Dwon command is invalid if the row is more than five or less than zero.
-      if ( row > 5 || row < 0 ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      }
-      // Down command is invalid if the index to the right is not a peg or the index after that is not empty.
-      else if ( puzzleBoard[ row ][ column ] != 'o' || puzzleBoard[ row + 1 ][ column ] != 'o' || puzzleBoard[ row + 2 ][ column ] != '.' ) {
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      }
-      // Otherwise, perform the valid move and udpate the undo history with the successful move.
-      else {
-        // Perform the move.
-        puzzleBoard[ row ][ column ] = '.';
-        puzzleBoard[ row + 1 ][ column ] = '.';
-        puzzleBoard[ row + 2 ][ column ] = 'o';
-
-        // Update the undo history to include the most recent move.
-        strcpy( undoHistory[ 2 ], undoHistory[ 1 ] );
-        strcpy( undoHistory[ 1 ], undoHistory[ 0 ] );
-        strcpy( undoHistory[ 0 ], serverReceive );
-
-        // Send a success message.
-        mq_send( clientQueue, successMessage, strlen( successMessage ), 0 );
-      } 
-    }
-    // Perform the undo move if the the undo command is inputted.
-    else if( serverReceive[ 0 ] == 'u' && serverReceive[ 1 ] == 'n') {
-      // Send error if no move has been made or the undo history is empty.
-      if ( strlen( undoHistory[ 0 ] ) <= 1 )
-        mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-      // Otherwise undo the move and send a success message.
-      else {
-        // Undo a right command.
-        if( undoHistory[ 0 ][ 0 ] == 'r' ) {
-          // Row of the peg to undo.
-          int row = undoHistory[ 0 ][ 6 ] - '0';
-          // Column of the peg to undo.
-          int column = undoHistory[ 0 ][ 8 ] - '0';
-
-          // Perform the opposite of the most recent move in the undo history.
-          puzzleBoard[ row ][ column ] = 'o';
-          puzzleBoard[ row ][ column + 1 ] = 'o';
-          puzzleBoard[ row ][ column + 2 ] = '.';
-        }
-        // Undo a left command.
-        else if( undoHistory[ 0 ][ 0 ] == 'l' ) {
-          // Row of the peg to undo.
-          int row = undoHistory[ 0 ][ 5 ] - '0';
-          // Column of the peg to undo.
-          int column = undoHistory[ 0 ][ 7 ] - '0';
-
-          // Perform the opposite of the most recent move in the undo history.
-          puzzleBoard[ row ][ column ] = 'o';
-          puzzleBoard[ row ][ column - 1 ] = 'o';
-          puzzleBoard[ row ][ column - 2 ] = '.';
-        }
-        // Undo an up command.
-        else if( undoHistory[ 0 ][ 0 ] == 'u' ) {
-          // Row of the peg to undo.
-          int row = undoHistory[ 0 ][ 3 ] - '0';
-          // Column of the peg to undo.
-          int column = undoHistory[ 0 ][ 5 ] - '0';
-
-          // Perform the opposite of the most recent move in the undo history.
-          puzzleBoard[ row ][ column ] = 'o';
-          puzzleBoard[ row - 1 ][ column ] = 'o';
-          puzzleBoard[ row - 2 ][ column ] = '.';
-        }
-        // Undo a down command.
-        else if( undoHistory[ 0 ][ 0 ] == 'd' ) {
-          // Row of the peg to undo.
-          int row = undoHistory[ 0 ][ 5 ] - '0';
-          // Column of the peg to undo.
-          int column = undoHistory[ 0 ][ 7 ] - '0';
-
-          // Perform the opposite of the most recent move in the undo history.
-          puzzleBoard[ row ][ column ] = 'o';
-          puzzleBoard[ row + 1 ][ column ] = 'o';
-          puzzleBoard[ row + 2 ][ column ] = '.';
-        }
-
-        // Update the undo history to not include the most recent move.
-        strcpy( undoHistory[ 0 ], undoHistory[ 1 ] );
-        strcpy( undoHistory[ 1 ], undoHistory[ 2 ] );
-        strcpy( undoHistory[ 2 ], "" );
-
-        // Send a success message to the client.
-        mq_send( clientQueue, successMessage, strlen( successMessage ), 0 );
-      }
-    }
-    // Perform the show command if this command is inputted.
-    else if( strcmp( serverReceive, "show" ) == 0 ) {
-      // String that the board message will be contained in.
-      char boardMessage[ 73 ] = "";
-
-      // Copy the puzzle board into the message
-      strncpy( boardMessage, puzzleBoard[ 0 ], 9 );
-      for ( int i = 1; i < GRID_SIZE; i++ ) {
-        strncat( boardMessage, puzzleBoard[ i ], 9 );
-      }
+  }
 
-      // Ensure null terminator is at the end of the board message.
-      strcat( boardMessage, "\0" );
+  // Print out the puzzle board on ctrl-c.
+  char boardMessage[ GRID_SIZE * ( GRID_SIZE + 1 ) + 1 ] = "";
+  boardText( boardMessage );
+  fprintf( stderr, "\n%s", boardMessage );
 
-      mq_send( clientQueue, boardMessage, strlen( boardMessage ), 0 );
-    }
-    else {
-      // whatever error is... NOT RIGHT _-----_______------______----- 
-      mq_send( clientQueue, errorMessage, strlen( errorMessage ), 0 );
-    }
+  // Hang up on the socket clients and remove the socket.
+  for ( int i = 0; i < MAX_CONNECTIONS; i++ )
+    if ( connections[ i ].fd != -1 )
+      closeConnection( epollFd, &connections[ i ] );
+  close( listenFd );
+  close( signalFd );
+  close( epollFd );
+  unlink( SERVER_SOCKET );
 
-    //fprintf( stderr, "\n%s\n%s\n%s\n", undoHistory[ 0 ], undoHistory[ 1 ], undoHistory[ 2 ] );
-  }
+  // Unmap the endgame database if it was used.
+  if ( endgameLoaded )
+    closeEndgame( &endgame );
 
   // Close our two message queues (and delete them).
-  mq_close( clientQueue );
+  if ( clientQueue != -1 )
+    mq_close( clientQueue );
   mq_close( serverQueue );
 
   mq_unlink( SERVER_QUEUE );